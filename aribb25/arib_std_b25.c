@@ -11,6 +11,32 @@
 #endif
 #include "ts_common_types.h"
 #include "ts_section_parser.h"
+#include "portable_thread.h"
+#include "portable_time.h"
+
+/* sync byte scans: AVX2 when the build targets it, SSE2 (always there on
+   x64), else plain C */
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define SYNC_SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define SYNC_SCAN_SSE2
+#endif
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+/* ring work buffers need a memory file to map twice */
+#if defined(__linux__)
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <linux/memfd.h>
+	#if defined(SYS_memfd_create)
+		#define ENABLE_RING_BUFFER
+	#endif
+#endif
 
 #if !defined(_WIN32)
 	#define __STDC_FORMAT_MACROS
@@ -48,8 +74,20 @@ typedef struct {
 	uint8_t          *tail;
 	int32_t           max;
 
+	/* RING_BUFFER_*, a ring is max bytes mapped twice in a row so that
+	   head up to tail is always contiguous */
+	int32_t           ring;
+
 } TS_WORK_BUFFER;
 
+enum RING_BUFFER_MODE {
+	RING_BUFFER_OFF  = 0,
+	RING_BUFFER_ON   = 1,
+	RING_BUFFER_HUGE = 2,
+};
+
+#define RING_HUGE_PAGE_SIZE (2*1024*1024)
+
 typedef struct {
 
 	int32_t            phase;
@@ -81,6 +119,10 @@ typedef struct {
 	int32_t            unpurchased;
 	int32_t            last_error;
 
+	int32_t            crypt;         /* parity last decrypted */
+	int32_t            ecm_busy;      /* ECM on the card thread, one at most */
+	int32_t            ecm_crypt;     /* crypt in use when the ECM went */
+
 	void              *prev;
 	void              *next;
 
@@ -92,19 +134,65 @@ typedef struct {
 	int32_t            count;
 } DECRYPTOR_LIST;
 
+/* looked up for every packet, so kept to 4 bytes per PID */
+typedef struct {
+	uint16_t           type;
+	uint16_t           slot;          /* in ARIB_STD_B25_PRIVATE_DATA::slot */
+} PID_MAP;
+
+/* the rest of what is known about a PID, only for PIDs in use -
+   slot 0 stays all zero for the others */
 typedef struct {
-	uint32_t           ref;
-	uint32_t           type;
+	int32_t            ref;
+	void              *target;
 	int64_t            normal_packet;
 	int64_t            undecrypted;
-	void              *target;
-} PID_MAP;
+} PID_SLOT;
+
+/* what proc_arib_std_b25() needs from a TS header, see classify_packets() */
+typedef struct {
+	uint16_t           pid;
+	uint8_t            crypt;         /* transport_scrambling_control */
+	uint8_t            flags;         /* TS_PACKET_FLAG_* */
+} TS_PACKET_DESC;
+
+/* headers classified per pass of classify_packets() */
+#define TS_PACKET_WINDOW 64
+
+/* the scrambled payloads of one proc_packet_run(), for a worker thread */
+typedef struct {
+	MULTI2            *m2;
+	int32_t            count;
+	MULTI2_BATCH_ENTRY ent[TS_PACKET_WINDOW];
+	uint8_t           *hdr[TS_PACKET_WINDOW];
+} DECRYPT_JOB;
+
+/* an ECM section for the card thread */
+typedef struct {
+	DECRYPTOR_ELEM    *dec;      /* NULL - removed meanwhile */
+	int32_t            done;
+	int32_t            r;        /* of bcas->proc_ecm() */
+	B_CAS_ECM_RESULT   res;
+	int32_t            table_id;
+	uint32_t           crc;
+	uint32_t           len;
+	uint8_t            data[4096];
+} ECM_JOB;
+
+#define ECM_JOB_MAX 8
+
+typedef struct {
+	uint8_t           *data;     /* NULL - in dbuf, offset bytes from its head */
+	intptr_t           offset;
+	uint32_t           size;
+} OUTPUT_RUN;
 
 typedef struct {
 
 	int32_t            multi2_round;
 	int32_t            strip;
 	int32_t            emm_proc_on;
+	int32_t            in_place;
 #ifdef ENABLE_MULTI2_SIMD
 	int32_t            simd_instruction;
 #endif
@@ -124,6 +212,9 @@ typedef struct {
 	DECRYPTOR_LIST     decrypt;
 
 	PID_MAP            map[0x2000];
+	PID_SLOT          *slot;
+	int32_t            slot_count;
+	int32_t            slot_max;
 
 	B_CAS_CARD        *bcas;
 	B_CAS_ID           casid;
@@ -135,6 +226,58 @@ typedef struct {
 	TS_WORK_BUFFER     sbuf;
 	TS_WORK_BUFFER     dbuf;
 
+	/* in-place output in the order it was made, dbuf may move so
+	   runs in it are kept as offsets */
+	OUTPUT_RUN        *run;
+	int32_t            run_count;
+	int32_t            run_max;
+	intptr_t           run_dbuf;      /* dbuf bytes already in runs */
+
+	/* handed out by get() and get_iov() */
+	ARIB_STD_B25_BUFFER *iov;
+	int32_t            iov_count;
+	int32_t            iov_next;
+	int32_t            iov_max;
+
+	/* set_worker_count(), job is a queue of job_max */
+	int32_t            worker_count;
+	THREAD            *worker;
+	THREAD_MUTEX       job_lock;
+	THREAD_COND        job_added;
+	THREAD_COND        job_done;
+	DECRYPT_JOB       *job;
+	int32_t            job_max;
+	int32_t            job_head;
+	int32_t            job_count;
+	int32_t            job_busy;      /* taken, not finished */
+	int32_t            job_error;
+	int32_t            job_quit;
+
+	/* set_low_latency(), scrambled packets (and those of their PIDs
+	   behind them) wait in hbuf for their key while the startup is not
+	   complete */
+	int32_t            hold_max;      /* bytes, 0 - off */
+	int32_t            hold_msec;     /* 0 - no time limit */
+	int32_t            holding;       /* in the current pass */
+	int64_t            hold_since;    /* get_msec() of the oldest one */
+	TS_WORK_BUFFER     hbuf;
+	uint32_t           held[0x2000/32]; /* PIDs with packets in hbuf */
+
+	/* set_async_ecm(), ecm_job is a queue of ECM_JOB_MAX */
+	int32_t            ecm_hold_max;  /* bytes */
+	THREAD             ecm_thread;
+	THREAD_MUTEX       ecm_lock;
+	THREAD_COND        ecm_added;
+	THREAD_COND        ecm_done;
+	ECM_JOB           *ecm_job;
+	int32_t            ecm_head;
+	int32_t            ecm_count;
+	int32_t            ecm_taken;     /* from ecm_head on, sent to the card */
+	int32_t            ecm_quit;
+
+	/* set_ecm_cache(), a reference is held */
+	ECM_CACHE         *ecm_cache;
+
 } ARIB_STD_B25_PRIVATE_DATA;
 
 typedef struct {
@@ -328,6 +471,26 @@ enum PID_MAP_TYPE {
 	PID_MAP_TYPE_OTHER                          = 0xff00,
 };
 
+enum TS_PACKET_FLAG {
+	/* the low 2 bits are adaptation_field_control */
+	TS_PACKET_FLAG_PAYLOAD                      = 0x01,
+	TS_PACKET_FLAG_ADAPTATION                   = 0x02,
+	TS_PACKET_FLAG_ERROR                        = 0x04,
+	TS_PACKET_FLAG_NULL                         = 0x08,
+	/* this and the next packet start with 0x47 */
+	TS_PACKET_FLAG_SYNC                         = 0x10,
+};
+
+/* what proc_packet_run() does with each packet of a run */
+enum TS_PACKET_ACTION {
+	TS_PACKET_ACTION_COPY                       = 0, /* transport error, as is */
+	TS_PACKET_ACTION_STRIP                      = 1,
+	TS_PACKET_ACTION_CLEAR                      = 2,
+	TS_PACKET_ACTION_DECRYPT                    = 3,
+	TS_PACKET_ACTION_NO_KEY                     = 4,
+	TS_PACKET_ACTION_NO_PAYLOAD                 = 5, /* scrambled, but no payload */
+};
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function prototypes (interface method)
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -346,6 +509,14 @@ static int get_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf);
 static int get_program_count_arib_std_b25(void *std_b25);
 static int get_program_info_arib_std_b25(void *std_b25, ARIB_STD_B25_PROGRAM_INFO *info, int idx);
 static int withdraw_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf);
+static int set_in_place_arib_std_b25(void *std_b25, int32_t on);
+static int get_iov_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER **iov);
+static int put_iov_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *iov, int32_t count);
+static int set_worker_count_arib_std_b25(void *std_b25, int32_t count);
+static int set_ring_buffer_arib_std_b25(void *std_b25, int32_t mode);
+static int set_low_latency_arib_std_b25(void *std_b25, int32_t max_bytes, int32_t max_msec);
+static int set_async_ecm_arib_std_b25(void *std_b25, int32_t max_hold);
+static int set_ecm_cache_arib_std_b25(void *std_b25, ECM_CACHE *cache);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
@@ -365,6 +536,15 @@ ARIB_STD_B25 *create_arib_std_b25(void)
 		return NULL;
 	}
 
+	/* slot 0 is the all zero one unused PIDs point at */
+	prv->slot = (PID_SLOT *)calloc(64, sizeof(PID_SLOT));
+	if(prv->slot == NULL){
+		free(prv);
+		return NULL;
+	}
+	prv->slot_count = 1;
+	prv->slot_max = 64;
+
 	prv->multi2_round = 4;
 #ifdef ENABLE_MULTI2_SIMD
 	prv->simd_instruction = (int32_t)get_supported_simd_instruction();
@@ -388,6 +568,14 @@ ARIB_STD_B25 *create_arib_std_b25(void)
 	r->get_program_count = get_program_count_arib_std_b25;
 	r->get_program_info = get_program_info_arib_std_b25;
 	r->withdraw = withdraw_arib_std_b25;
+	r->set_in_place = set_in_place_arib_std_b25;
+	r->get_iov = get_iov_arib_std_b25;
+	r->put_iov = put_iov_arib_std_b25;
+	r->set_worker_count = set_worker_count_arib_std_b25;
+	r->set_ring_buffer = set_ring_buffer_arib_std_b25;
+	r->set_low_latency = set_low_latency_arib_std_b25;
+	r->set_async_ecm = set_async_ecm_arib_std_b25;
+	r->set_ecm_cache = set_ecm_cache_arib_std_b25;
 
 	return r;
 }
@@ -408,11 +596,51 @@ static int32_t add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *li
 static int check_ecm_complete(ARIB_STD_B25_PRIVATE_DATA *prv);
 static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv);
 #ifdef ENABLE_MULTI2_SIMD
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int32_t simd_instruction);
+static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, ECM_CACHE *cache, int32_t multi2_round, int32_t simd_instruction);
+static int set_ecm_result(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int32_t simd_instruction, int r, B_CAS_ECM_RESULT *res);
 #else
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round);
+static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, ECM_CACHE *cache, int32_t multi2_round);
+static int set_ecm_result(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int r, B_CAS_ECM_RESULT *res);
 #endif
+static int check_ecm_purchased(B_CAS_ECM_RESULT *res);
+static void store_ecm_result(ECM_CACHE *cache, int32_t table_id, uint32_t crc, uint8_t *data, uint32_t len, int r, B_CAS_ECM_RESULT *res);
+static uint32_t get_section_crc(TS_SECTION *sect);
 static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int proc_packets(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int32_t proc_packet_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr, TS_PACKET_DESC *desc, int32_t count, int32_t in_place, int32_t *slow);
+static int check_proc_ready(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int put_buffer(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf);
+static int put_work_buffer(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, int32_t count);
+static int put_in_place(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf);
+static int put_low_latency(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int release_held_packets(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t all);
+static int decrypt_held_packets(ARIB_STD_B25_PRIVATE_DATA *prv);
+static DECRYPTOR_ELEM *find_held_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+static int check_key_ready(DECRYPTOR_ELEM *dec, int32_t crypt);
+static int check_hold_expired(ARIB_STD_B25_PRIVATE_DATA *prv);
+static int check_hold_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t crypt);
+static int check_held_pid(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+static void add_held_pid(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+static int join_output(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *data);
+static int close_output_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *tail);
+static int add_output_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *data, intptr_t offset, intptr_t size);
+static int collect_output(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void *reserve_array(void *array, int32_t *max, int32_t count, size_t size);
+
+static int start_workers(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t count);
+static void stop_workers(ARIB_STD_B25_PRIVATE_DATA *prv);
+static THREAD_RESULT THREAD_CALL decrypt_worker(void *arg);
+static void add_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, MULTI2 *m2, MULTI2_BATCH_ENTRY *ent, uint8_t **hdr, int32_t count);
+static void take_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPT_JOB *dst);
+static void run_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPT_JOB *job);
+static int wait_decrypt_jobs(ARIB_STD_B25_PRIVATE_DATA *prv);
+
+static int start_ecm_thread(ARIB_STD_B25_PRIVATE_DATA *prv);
+static void stop_ecm_thread(ARIB_STD_B25_PRIVATE_DATA *prv);
+static THREAD_RESULT THREAD_CALL ecm_worker(void *arg);
+static int add_ecm_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
+static int poll_ecm_jobs(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t max);
+static int release_ecm_held(ARIB_STD_B25_PRIVATE_DATA *prv);
 
 static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv);
 static int proc_emm(ARIB_STD_B25_PRIVATE_DATA *prv);
@@ -421,6 +649,10 @@ static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm);
 
 static void unref_stream(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
 
+static void clear_pid_map(ARIB_STD_B25_PRIVATE_DATA *prv);
+static PID_SLOT *find_pid_slot(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+static PID_SLOT *add_pid_slot(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
+
 static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid);
 static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec);
 static DECRYPTOR_ELEM *select_active_decryptor(DECRYPTOR_ELEM *a, DECRYPTOR_ELEM *b, int32_t pid);
@@ -435,14 +667,26 @@ static void clear_stream_list(TS_STREAM_LIST *list);
 
 static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size);
 static int append_work_buffer(TS_WORK_BUFFER *buf, uint8_t *data, int32_t size);
+static int append_decrypted_packet(TS_WORK_BUFFER *buf, MULTI2 *m2, int32_t crypt, uint8_t *data, int32_t offset, int32_t payload, int32_t size);
+static void consume_work_buffer(TS_WORK_BUFFER *buf, uint8_t *curr);
+static int convert_work_buffer(TS_WORK_BUFFER *buf, int32_t ring);
 static void reset_work_buffer(TS_WORK_BUFFER *buf);
 static void release_work_buffer(TS_WORK_BUFFER *buf);
+#if defined(ENABLE_RING_BUFFER)
+static uint8_t *map_ring(int *size, int32_t ring);
+static uint8_t *map_ring_pages(int *size, intptr_t page, unsigned int flags);
+#endif
 
 static void extract_ts_header(TS_HEADER *dst, uint8_t *src);
+static int32_t classify_packets(TS_PACKET_DESC *dst, uint8_t *head, uint8_t *tail, int32_t unit_size);
 static void extract_emm_fixed_part(EMM_FIXED_PART *dst, uint8_t *src);
 
 static uint8_t *resync(uint8_t *head, uint8_t *tail, int32_t unit);
 static uint8_t *resync_force(uint8_t *head, uint8_t *tail, int32_t unit);
+static uint8_t *resync_resume(uint8_t *head, uint8_t *tail, int32_t unit);
+static int check_sync_force(uint8_t *buf, uint8_t *tail, int32_t unit);
+static uint32_t sync_byte_mask(uint8_t *p);
+static int32_t lowest_bit(uint32_t mask);
 
 static void fill_random_bytes(uint8_t *data, size_t size);
 
@@ -458,7 +702,13 @@ static void release_arib_std_b25(void *std_b25)
 		return;
 	}
 
+	stop_ecm_thread(prv);
+	stop_workers(prv);
 	teardown(prv);
+	if(prv->ecm_cache != NULL){
+		prv->ecm_cache->release(prv->ecm_cache);
+	}
+	free(prv->slot);
 	free(prv);
 }
 
@@ -546,6 +796,12 @@ static int set_b_cas_card_arib_std_b25(void *std_b25, B_CAS_CARD *bcas)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	/* the card thread is done with the old one */
+	n = poll_ecm_jobs(prv, 0);
+	if(n < 0){
+		return n;
+	}
+
 	prv->bcas = bcas;
 	if(prv->bcas != NULL){
 		n = prv->bcas->get_init_status(bcas, &is);
@@ -588,10 +844,12 @@ static int flush_arib_std_b25(void *std_b25)
 	uint8_t *p;
 	uint8_t *curr;
 	uint8_t *tail;
+	uint8_t *out;
 
 	TS_HEADER hdr;
 	DECRYPTOR_ELEM *dec;
 	TS_PROGRAM *pgrm;
+	PID_SLOT *slot;
 
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
@@ -600,6 +858,9 @@ static int flush_arib_std_b25(void *std_b25)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	prv->iov_count = 0;
+	prv->iov_next = 0;
+
 	if(prv->unit_size < 188){
 		r = select_unit_size(prv);
 		if(r < 0){
@@ -610,7 +871,15 @@ static int flush_arib_std_b25(void *std_b25)
 		}
 	}
 
+	prv->holding = (prv->hold_max > 0) && !check_proc_ready(prv);
 	r = proc_arib_std_b25(prv);
+	prv->holding = 0;
+	if(r < 0){
+		return r;
+	}
+
+	/* no key is coming any more */
+	r = release_held_packets(prv, 1);
 	if(r < 0){
 		return r;
 	}
@@ -646,6 +915,7 @@ static int flush_arib_std_b25(void *std_b25)
 		extract_ts_header(&hdr, curr);
 		crypt = hdr.transport_scrambling_control;
 		pid = hdr.pid;
+		out = NULL;
 
 		if(hdr.transport_error_indicator != 0){
 			/* bit error - append output buffer without parsing */
@@ -678,11 +948,17 @@ static int flush_arib_std_b25(void *std_b25)
 			n = 188 - 4;
 		}
 
+		slot = add_pid_slot(prv, pid);
+		if(slot == NULL){
+			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			goto LAST;
+		}
+
 		if(crypt != 0){
 			if(hdr.adaptation_field_control & 0x01){
 
 				if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
-					dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+					dec = (DECRYPTOR_ELEM *)(slot->target);
 				}else if( (prv->map[pid].type == 0) &&
 					  (prv->decrypt.count == 1) ){
 					dec = prv->decrypt.head;
@@ -691,42 +967,44 @@ static int flush_arib_std_b25(void *std_b25)
 				}
 
 				if( (dec != NULL) && (dec->m2 != NULL) ){
-					m = dec->m2->decrypt(dec->m2, crypt, p, n);
+					if((curr+unit) <= tail){
+						l = unit;
+					}else{
+						l = 188;
+					}
+					m = append_decrypted_packet(&(prv->dbuf), dec->m2, crypt, curr, (int32_t)(p-curr), (int32_t)n, l);
 					if(m < 0){
-						r = ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
-						if((curr+unit) <= tail){
-							l = unit;
-						}else{
-							l = 188;
-						}
+						r = (int)m;
 						curr += l;
 						goto LAST;
 					}
-					curr[3] &= 0x3f;
-					prv->map[pid].normal_packet += 1;
+					out = prv->dbuf.tail - l;
+					slot->normal_packet += 1;
 				}else{
-					prv->map[pid].undecrypted += 1;
+					slot->undecrypted += 1;
 				}
 			}else{
 				curr[3] &= 0x3f;
-				prv->map[pid].normal_packet += 1;
+				slot->normal_packet += 1;
 			}
 		}else{
-			prv->map[pid].normal_packet += 1;
+			slot->normal_packet += 1;
 		}
 
-		if((curr+unit) <= tail){
-			l = unit;
-		}else{
-			l = 188;
-		}
-		if(!append_work_buffer(&(prv->dbuf), curr, l)){
-			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
-			goto LAST;
+		if(out == NULL){
+			if((curr+unit) <= tail){
+				l = unit;
+			}else{
+				l = 188;
+			}
+			if(!append_work_buffer(&(prv->dbuf), curr, l)){
+				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				goto LAST;
+			}
 		}
 
 		if(prv->map[pid].type == PID_MAP_TYPE_ECM){
-			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+			dec = (DECRYPTOR_ELEM *)(slot->target);
 			if( (dec == NULL) || (dec->ecm == NULL) ){
 				/* this code will never execute */
 				r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
@@ -764,9 +1042,9 @@ static int flush_arib_std_b25(void *std_b25)
 				goto NEXT;
 			}
 #ifdef ENABLE_MULTI2_SIMD
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round, prv->simd_instruction);
+			r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round, prv->simd_instruction);
 #else
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+			r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round);
 #endif
 			if(r < 0){
 				if((curr+unit) <= tail){
@@ -778,7 +1056,7 @@ static int flush_arib_std_b25(void *std_b25)
 				goto LAST;
 			}
 		}else if(prv->map[pid].type == PID_MAP_TYPE_PMT){
-			pgrm = (TS_PROGRAM *)(prv->map[pid].target);
+			pgrm = (TS_PROGRAM *)(slot->target);
 			if( (pgrm == NULL) || (pgrm->pmt == NULL) ){
 				/* this code will never execute */
 				r = ARIB_STD_B25_ERROR_PMT_PARSE_FAILURE;
@@ -964,27 +1242,13 @@ static int flush_arib_std_b25(void *std_b25)
 	}
 
 LAST:
-
-	m = curr - prv->sbuf.pool;
-	n = tail - curr;
-	if( (n < 1024) || (m > (prv->sbuf.max/2) ) ){
-		p = prv->sbuf.pool;
-		if(n > 0){
-			memcpy(p, curr, n);
-		}
-		prv->sbuf.head = p;
-		prv->sbuf.tail = p+n;
-	}else{
-		prv->sbuf.head = curr;
-	}
+	consume_work_buffer(&(prv->sbuf), curr);
 
 	return r;
 }
 
 static int put_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 {
-	int r;
-	intptr_t slen,dlen;
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
 	prv = private_data(std_b25);
@@ -992,82 +1256,10 @@ static int put_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	slen = prv->sbuf.tail - prv->sbuf.head;
-	dlen = prv->dbuf.tail - prv->dbuf.head;
-
-	if(!append_work_buffer(&(prv->sbuf), buf->data, buf->size)){
-		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
-	}
-
-	if(prv->unit_size < 188){
-		r = select_unit_size(prv);
-		if(r < 0){
-			return r;
-		}
-		if(prv->unit_size < 188){
-			/* need more data */
-			return 0;
-		}
-	}
-
-	if(prv->p_count < 1){
-		r = find_pat(prv);
-		if(r < 0){
-			return r;
-		}
-		if(prv->p_count < 1){
-			if(prv->sbuf_offset < (16*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_PAT_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_PAT_IN_HEAD_16M;
-			}
-		}
-		prv->sbuf_offset = 0;
-	}
-
-	if(!check_pmt_complete(prv)){
-		r = find_pmt(prv);
-		if(r < 0){
-			return r;
-		}
-		if(!check_pmt_complete(prv)){
-			if(prv->sbuf_offset < (32*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_PMT_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_PMT_IN_HEAD_32M;
-			}
-		}
-		prv->sbuf_offset = 0;
-	}
-
-	if(!check_ecm_complete(prv)){
-		r = find_ecm(prv);
-		if(r < 0){
-			return r;
-		}
-		if(!check_ecm_complete(prv)){
-			if(prv->sbuf_offset < (32*1024*1024)){
-				/* need more data */
-				return ARIB_STD_B25_WARN_ECM_NOT_COMPLETE;
-			}else{
-				/* exceed sbuf limit */
-				return ARIB_STD_B25_ERROR_NO_ECM_IN_HEAD_32M;
-			}
-		}
-		prv->sbuf_offset = 0;
-	}
+	prv->iov_count = 0;
+	prv->iov_next = 0;
 
-	r = proc_arib_std_b25(prv);
-	if(r < 0){
-		/* rollback */
-		prv->sbuf.tail = prv->sbuf.head + slen;
-		prv->dbuf.tail = prv->dbuf.head + dlen;
-	}
-	return r;
+	return put_buffer(prv, buf);
 }
 
 static int get_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
@@ -1078,6 +1270,20 @@ static int get_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
+	if( (prv->run_count > 0) || (prv->iov_next < prv->iov_count) ){
+		/* in-place output, one run per call */
+		if(!collect_output(prv)){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		if(prv->iov_next < prv->iov_count){
+			*buf = prv->iov[prv->iov_next++];
+			return 0;
+		}
+	}
+
+	prv->iov_count = 0;
+	prv->iov_next = 0;
+
 	buf->data = prv->dbuf.head;
 	buf->size = (uint32_t)(prv->dbuf.tail - prv->dbuf.head);	// cast
 
@@ -1106,6 +1312,7 @@ static int get_program_info_arib_std_b25(void *std_b25, ARIB_STD_B25_PROGRAM_INF
 
 	TS_STREAM_ELEM *strm;
 	DECRYPTOR_ELEM *dec;
+	PID_SLOT *slot;
 
 	int32_t pid;
 
@@ -1120,29 +1327,31 @@ static int get_program_info_arib_std_b25(void *std_b25, ARIB_STD_B25_PROGRAM_INF
 
 	info->program_number = pgrm->program_number;
 
-	pid = pgrm->pmt_pid;
-	info->total_packet_count += prv->map[pid].normal_packet;
-	info->total_packet_count += prv->map[pid].undecrypted;
-	info->undecrypted_packet_count += prv->map[pid].undecrypted;
+	slot = find_pid_slot(prv, pgrm->pmt_pid);
+	info->total_packet_count += slot->normal_packet;
+	info->total_packet_count += slot->undecrypted;
+	info->undecrypted_packet_count += slot->undecrypted;
 
 	pid = pgrm->pcr_pid;
 	if( (pid != 0) && (pid != 0x1fff) ){
-		info->total_packet_count += prv->map[pid].normal_packet;
-		info->total_packet_count += prv->map[pid].undecrypted;
-		info->undecrypted_packet_count += prv->map[pid].undecrypted;
+		slot = find_pid_slot(prv, pid);
+		info->total_packet_count += slot->normal_packet;
+		info->total_packet_count += slot->undecrypted;
+		info->undecrypted_packet_count += slot->undecrypted;
 	}
 
 	strm = pgrm->streams.head;
 	while(strm != NULL){
 		pid = strm->pid;
+		slot = find_pid_slot(prv, pid);
 		if(prv->map[pid].type == PID_MAP_TYPE_ECM){
-			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+			dec = (DECRYPTOR_ELEM *)(slot->target);
 			info->ecm_unpurchased_count += dec->unpurchased;
 			info->last_ecm_error_code = dec->last_error;
 		}
-		info->total_packet_count += prv->map[pid].normal_packet;
-		info->total_packet_count += prv->map[pid].undecrypted;
-		info->undecrypted_packet_count += prv->map[pid].undecrypted;
+		info->total_packet_count += slot->normal_packet;
+		info->total_packet_count += slot->undecrypted;
+		info->undecrypted_packet_count += slot->undecrypted;
 		strm = (TS_STREAM_ELEM *)(strm->next);
 	}
 
@@ -1165,97 +1374,307 @@ static int withdraw_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *buf)
 	return 0;
 }
 
-/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
- private method implementation
- ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-static ARIB_STD_B25_PRIVATE_DATA *private_data(void *std_b25)
+static int set_in_place_arib_std_b25(void *std_b25, int32_t on)
 {
-	ARIB_STD_B25 *p;
-	ARIB_STD_B25_PRIVATE_DATA *r;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	p = (ARIB_STD_B25 *)std_b25;
-	if(p == NULL){
-		return NULL;
+	prv = private_data(std_b25);
+	if(prv == NULL){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	r = (ARIB_STD_B25_PRIVATE_DATA *)p->private_data;
-	if( ((void *)(r+1)) != ((void *)p) ){
-		return NULL;
-	}
+	prv->in_place = on;
 
-	return r;
+	return 0;
 }
 
-static void teardown(ARIB_STD_B25_PRIVATE_DATA *prv)
+static int get_iov_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER **iov)
 {
-	int i;
+	int n;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	prv->unit_size = 0;
-	prv->sbuf_offset = 0;
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (iov == NULL) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
 
-	if(prv->pat != NULL){
-		prv->pat->release(prv->pat);
-		prv->pat = NULL;
+	if(!collect_output(prv)){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
-	if(prv->cat != NULL){
-		prv->cat->release(prv->cat);
-		prv->cat = NULL;
+
+	*iov = prv->iov + prv->iov_next;
+	n = prv->iov_count - prv->iov_next;
+
+	prv->iov_count = 0;
+	prv->iov_next = 0;
+
+	return n;
+}
+
+static int put_iov_arib_std_b25(void *std_b25, ARIB_STD_B25_BUFFER *iov, int32_t count)
+{
+	int r,i;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (count < 0) || ((iov == NULL) && (count > 0)) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	if(prv->program != NULL){
-		for(i=0;i<prv->p_count;i++){
-			release_program(prv, prv->program+i);
+	prv->iov_count = 0;
+	prv->iov_next = 0;
+
+	if(!prv->in_place){
+		/* one pass over all of them */
+		return put_work_buffer(prv, iov, count);
+	}
+
+	r = 0;
+	for(i=0;i<count;i++){
+		r = put_buffer(prv, iov+i);
+		if(r < 0){
+			/* the segments before are done */
+			while(i > 0){
+				iov[--i].size = 0;
+			}
+			return r;
 		}
-		free(prv->program);
-		prv->program = NULL;
 	}
-	prv->p_count = 0;
 
-	clear_stream_list(&(prv->strm_pool));
+	return r;
+}
 
-	while(prv->decrypt.head != NULL){
-		remove_decryptor(prv, prv->decrypt.head);
+static int set_worker_count_arib_std_b25(void *std_b25, int32_t count)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (count < 0) || (count > 64) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
 
-	memset(prv->map, 0, sizeof(prv->map));
+	stop_workers(prv);
 
-	prv->emm_pid = 0;
-	if(prv->emm != NULL){
-		prv->emm->release(prv->emm);
-		prv->emm = NULL;
+	if( (count > 0) && !start_workers(prv, count) ){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 	}
 
-	release_work_buffer(&(prv->sbuf));
-	release_work_buffer(&(prv->dbuf));
+	return 0;
 }
 
-static int set_unit_size_arib_std_b25(void *std_b25, int size)
+static int set_ring_buffer_arib_std_b25(void *std_b25, int32_t mode)
 {
 	ARIB_STD_B25_PRIVATE_DATA *prv;
 
 	prv = private_data(std_b25);
-	if (prv == NULL || size < 188 || size > 320) {
+	if( (prv == NULL) || (mode < RING_BUFFER_OFF) || (mode > RING_BUFFER_HUGE) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+#if !defined(ENABLE_RING_BUFFER)
+	if(mode != RING_BUFFER_OFF){
 		return ARIB_STD_B25_ERROR_INVALID_PARAM;
 	}
+#endif
 
-	prv->unit_size = size;
+	if( !convert_work_buffer(&(prv->sbuf), mode) ||
+	    !convert_work_buffer(&(prv->dbuf), mode) ){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
 
 	return 0;
 }
 
-static int select_unit_size(ARIB_STD_B25_PRIVATE_DATA *prv)
+static int set_low_latency_arib_std_b25(void *std_b25, int32_t max_bytes, int32_t max_msec)
 {
-	int i;
-	intptr_t m,w;
-	int n;
-	int count[320-188];
+	int r;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
 
-	unsigned char *head;
-	unsigned char *buf;
-	unsigned char *tail;
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (max_bytes < 0) || (max_msec < 0) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
 
-	head = prv->sbuf.head;
-	tail = prv->sbuf.tail;
+	prv->hold_max = max_bytes;
+	prv->hold_msec = max_msec;
+
+	if(max_bytes == 0){
+		/* what is held goes out as it is */
+		r = release_held_packets(prv, 1);
+		if(r < 0){
+			return r;
+		}
+	}
+
+	return 0;
+}
+
+static int set_async_ecm_arib_std_b25(void *std_b25, int32_t max_hold)
+{
+	int r;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if( (prv == NULL) || (max_hold < 0) ){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	if(max_hold == 0){
+		/* waits for the card, what is held goes out */
+		r = release_held_packets(prv, 1);
+		if(r < 0){
+			return r;
+		}
+		stop_ecm_thread(prv);
+	}else if( (prv->ecm_job == NULL) && !start_ecm_thread(prv) ){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	prv->ecm_hold_max = max_hold;
+
+	return 0;
+}
+
+static int set_ecm_cache_arib_std_b25(void *std_b25, ECM_CACHE *cache)
+{
+	int r;
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if(prv == NULL){
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	/* the answers on the way go to the old one */
+	r = poll_ecm_jobs(prv, 0);
+	if(r < 0){
+		return r;
+	}
+
+	if(cache != NULL){
+		r = cache->add_ref(cache);
+		if(r < 0){
+			return ARIB_STD_B25_ERROR_INVALID_PARAM;
+		}
+	}
+	if(prv->ecm_cache != NULL){
+		prv->ecm_cache->release(prv->ecm_cache);
+	}
+	prv->ecm_cache = cache;
+
+	return 0;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ARIB_STD_B25_PRIVATE_DATA *private_data(void *std_b25)
+{
+	ARIB_STD_B25 *p;
+	ARIB_STD_B25_PRIVATE_DATA *r;
+
+	p = (ARIB_STD_B25 *)std_b25;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (ARIB_STD_B25_PRIVATE_DATA *)p->private_data;
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void teardown(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int i;
+
+	prv->unit_size = 0;
+	prv->sbuf_offset = 0;
+
+	if(prv->pat != NULL){
+		prv->pat->release(prv->pat);
+		prv->pat = NULL;
+	}
+	if(prv->cat != NULL){
+		prv->cat->release(prv->cat);
+		prv->cat = NULL;
+	}
+
+	if(prv->program != NULL){
+		for(i=0;i<prv->p_count;i++){
+			release_program(prv, prv->program+i);
+		}
+		free(prv->program);
+		prv->program = NULL;
+	}
+	prv->p_count = 0;
+
+	clear_stream_list(&(prv->strm_pool));
+
+	while(prv->decrypt.head != NULL){
+		remove_decryptor(prv, prv->decrypt.head);
+	}
+
+	clear_pid_map(prv);
+
+	prv->emm_pid = 0;
+	if(prv->emm != NULL){
+		prv->emm->release(prv->emm);
+		prv->emm = NULL;
+	}
+
+	release_work_buffer(&(prv->sbuf));
+	release_work_buffer(&(prv->dbuf));
+	release_work_buffer(&(prv->hbuf));
+	prv->hold_since = 0;
+
+	if(prv->run != NULL){
+		free(prv->run);
+		prv->run = NULL;
+	}
+	prv->run_count = 0;
+	prv->run_max = 0;
+	prv->run_dbuf = 0;
+
+	if(prv->iov != NULL){
+		free(prv->iov);
+		prv->iov = NULL;
+	}
+	prv->iov_count = 0;
+	prv->iov_next = 0;
+	prv->iov_max = 0;
+}
+
+static int set_unit_size_arib_std_b25(void *std_b25, int size)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+
+	prv = private_data(std_b25);
+	if (prv == NULL || size < 188 || size > 320) {
+		return ARIB_STD_B25_ERROR_INVALID_PARAM;
+	}
+
+	prv->unit_size = size;
+
+	return 0;
+}
+
+static int select_unit_size(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int i,j,k;
+	intptr_t m,w;
+	int n;
+	int count[320-188];
+	uint16_t pos[188*32];
+	uint32_t mask;
+
+	unsigned char *head;
+	unsigned char *buf;
+	unsigned char *tail;
+
+	head = prv->sbuf.head;
+	tail = prv->sbuf.tail;
 
 	if((tail-head) < (188*16)){
 		// need more data
@@ -1268,24 +1687,34 @@ static int select_unit_size(ARIB_STD_B25_PRIVATE_DATA *prv)
 	buf = head;
 	memset(count, 0, sizeof(count));
 
-	// 1st step, count up 0x47 interval
-	while( (buf+188) < tail ){
-		if(buf[0] != 0x47){
-			buf += 1;
-			continue;
-		}
-		m = 320;
-		if( buf+m > tail ){
-			m = tail-buf;
+	// 1st step, count up 0x47 interval - list every 0x47, then count
+	// the pairs 188 to 319 bytes apart
+	n = 0;
+	while( (buf+32) <= tail ){
+		mask = sync_byte_mask(buf);
+		while(mask != 0){
+			pos[n++] = (uint16_t)((buf - head) + lowest_bit(mask));
+			mask &= mask - 1;
 		}
-		for(i=188;i<m;i++){
-			if(buf[i] == 0x47){
-				count[i-188] += 1;
-			}
+		buf += 32;
+	}
+	while( buf < tail ){
+		if(buf[0] == 0x47){
+			pos[n++] = (uint16_t)(buf - head);
 		}
 		buf += 1;
 	}
 
+	k = 0;
+	for(i=0;i<n;i++){
+		while( (k < n) && (pos[k] < pos[i]+188) ){
+			k += 1;
+		}
+		for(j=k;(j<n)&&(pos[j] < pos[i]+320);j++){
+			count[pos[j]-pos[i]-188] += 1;
+		}
+	}
+
 	// 2nd step, select maximum appeared interval
 	m = 0;
 	n = 0;
@@ -1331,6 +1760,7 @@ static int find_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
 			p = resync(curr, tail, unit);
 			if(p == NULL){
+				curr = resync_resume(curr, tail, unit);
 				goto LAST;
 			}
 			curr = p;
@@ -1403,6 +1833,7 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 	uint8_t *tail;
 
 	TS_PROGRAM *work;
+	PID_SLOT *slot;
 	TS_SECTION  sect;
 
 	r = 0;
@@ -1436,7 +1867,7 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 		prv->program = NULL;
 	}
 	prv->p_count = 0;
-	memset(&(prv->map), 0, sizeof(prv->map));
+	clear_pid_map(prv);
 
 	head = sect.data;
 	tail = sect.tail-4;
@@ -1453,8 +1884,14 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				break;
 			}
+			slot = add_pid_slot(prv, pid);
+			if(slot == NULL){
+				work[i].pmt->release(work[i].pmt);
+				r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				break;
+			}
 			prv->map[pid].type = PID_MAP_TYPE_PMT;
-			prv->map[pid].target = work+i;
+			slot->target = work+i;
 			i += 1;
 		}
 		head += 4;
@@ -1463,9 +1900,13 @@ static int proc_pat(ARIB_STD_B25_PRIVATE_DATA *prv)
 	prv->program = work;
 	prv->p_count = i;
 
-	prv->map[0x0000].ref = 1;
+	slot = add_pid_slot(prv, 0x0000);
+	if(slot == NULL){
+		r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		goto LAST;
+	}
+	slot->ref = 1;
 	prv->map[0x0000].type = PID_MAP_TYPE_PAT;
-	prv->map[0x0000].target = NULL;
 
 LAST:
 	if(sect.raw != NULL){
@@ -1531,6 +1972,7 @@ static int find_pmt(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
 			p = resync(curr, tail, unit);
 			if(p == NULL){
+				curr = resync_resume(curr, tail, unit);
 				goto LAST;
 			}
 			curr = p;
@@ -1580,7 +2022,7 @@ static int find_pmt(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if(prv->map[hdr.pid].type != PID_MAP_TYPE_PMT){
 			goto NEXT;
 		}
-		pgrm = (TS_PROGRAM *)(prv->map[hdr.pid].target);
+		pgrm = (TS_PROGRAM *)(find_pid_slot(prv, hdr.pid)->target);
 		if(pgrm == NULL){
 			goto NEXT;
 		}
@@ -1668,6 +2110,7 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 
 	DECRYPTOR_ELEM *dec[2];
 	DECRYPTOR_ELEM *dw;
+	PID_SLOT *slot;
 
 	TS_STREAM_ELEM *strm;
 	TS_STREAM_LIST tmp_old_strm;
@@ -1759,6 +2202,12 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 			dec[1] = NULL;
 		}
 
+		slot = add_pid_slot(prv, pid);
+		if(slot == NULL){
+			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			goto LAST;
+		}
+
 		strm = get_stream_list_head(&(prv->strm_pool));
 		if( strm == NULL ){
 			strm = create_stream_elem(pid, type);
@@ -1772,7 +2221,7 @@ static int proc_pmt(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 		}
 
 		prv->map[pid].type = PID_MAP_TYPE_OTHER;
-		prv->map[pid].ref += 1;
+		slot->ref += 1;
 
 		dw = select_active_decryptor(dec[0], dec[1], ecm_pid);
 		bind_stream_decryptor(prv, pid, dw);
@@ -1829,6 +2278,7 @@ static int32_t find_ca_descriptor_pid(uint8_t *head, uint8_t *tail, int32_t ca_s
 static int32_t add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *list, int32_t ecm_pid)
 {
 	TS_STREAM_ELEM *strm;
+	PID_SLOT *slot;
 
 	strm = find_stream_list_elem(list, ecm_pid);
 	if(strm != NULL){
@@ -1836,6 +2286,11 @@ static int32_t add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *li
 		return 1;
 	}
 
+	slot = add_pid_slot(prv, ecm_pid);
+	if(slot == NULL){
+		return 0;
+	}
+
 	strm = get_stream_list_head(&(prv->strm_pool));
 	if(strm == NULL){
 		strm = create_stream_elem(ecm_pid, PID_MAP_TYPE_ECM);
@@ -1848,7 +2303,7 @@ static int32_t add_ecm_stream(ARIB_STD_B25_PRIVATE_DATA *prv, TS_STREAM_LIST *li
 	}
 
 	put_stream_list_tail(list, strm);
-	prv->map[ecm_pid].ref += 1;
+	slot->ref += 1;
 
 	return 1;
 }
@@ -1898,6 +2353,12 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 	TS_HEADER hdr;
 	DECRYPTOR_ELEM *dec;
 
+	/* the card is one thread's at a time */
+	r = poll_ecm_jobs(prv, 0);
+	if(r < 0){
+		return r;
+	}
+
 	r = 0;
 	unit = prv->unit_size;
 	curr = prv->sbuf.head + prv->sbuf_offset;
@@ -1907,6 +2368,7 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
 			p = resync(curr, tail, unit);
 			if(p == NULL){
+				curr = resync_resume(curr, tail, unit);
 				goto LAST;
 			}
 			curr = p;
@@ -1955,7 +2417,7 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 		if(prv->map[hdr.pid].type != PID_MAP_TYPE_ECM){
 			goto NEXT;
 		}
-		dec = (DECRYPTOR_ELEM *)(prv->map[hdr.pid].target);
+		dec = (DECRYPTOR_ELEM *)(find_pid_slot(prv, hdr.pid)->target);
 		if(dec == NULL){
 			goto NEXT;
 		}
@@ -1997,9 +2459,9 @@ static int find_ecm(ARIB_STD_B25_PRIVATE_DATA *prv)
 			}
 
 #ifdef ENABLE_MULTI2_SIMD
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round, prv->simd_instruction);
+			r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round, prv->simd_instruction);
 #else
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+			r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round);
 #endif
 			if(r < 0){
 				curr += unit;
@@ -2033,9 +2495,9 @@ LAST:
 }
 
 #ifdef ENABLE_MULTI2_SIMD
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int32_t simd_instruction)
+static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, ECM_CACHE *cache, int32_t multi2_round, int32_t simd_instruction)
 #else
-static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
+static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, ECM_CACHE *cache, int32_t multi2_round)
 #endif
 {
 	int r,n;
@@ -2043,7 +2505,6 @@ static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
 
 	uint8_t *p;
 
-	B_CAS_INIT_STATUS is;
 	B_CAS_ECM_RESULT res;
 
 	TS_SECTION sect;
@@ -2077,28 +2538,66 @@ static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
 	len = (uint32_t)(sect.tail - sect.data) - 4;	// cast
 	p = sect.data;
 
-	r = bcas->proc_ecm(bcas, &res, p, len);
+	if( (cache != NULL) &&
+	    (cache->get(cache, sect.hdr.table_id, get_section_crc(&sect), p, len, &res) > 0) ){
+		/* another decoder has asked the card already */
+		r = 0;
+	}else{
+		r = bcas->proc_ecm(bcas, &res, p, len);
+		store_ecm_result(cache, sect.hdr.table_id, get_section_crc(&sect), p, len, r, &res);
+	}
+#ifdef ENABLE_MULTI2_SIMD
+	r = set_ecm_result(dec, bcas, multi2_round, simd_instruction, r, &res);
+#else
+	r = set_ecm_result(dec, bcas, multi2_round, r, &res);
+#endif
+
+LAST:
+	if(sect.raw != NULL){
+		n = dec->ecm->ret(dec->ecm, &sect);
+		if( (n < 0) && (r == 0) ){
+			r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
+		}
+	}
+
+	if(r == ARIB_STD_B25_ERROR_ECM_PROC_FAILURE){
+		/* the parser drops a repeated section, the same ECM must reach
+		   the card again once it is back */
+		dec->ecm->reset(dec->ecm);
+	}
+
+	return r;
+}
+
+/* r and res of bcas->proc_ecm() to the decryptor's key */
+#ifdef ENABLE_MULTI2_SIMD
+static int set_ecm_result(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int32_t simd_instruction, int r, B_CAS_ECM_RESULT *res)
+#else
+static int set_ecm_result(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round, int r, B_CAS_ECM_RESULT *res)
+#endif
+{
+	B_CAS_INIT_STATUS is;
+
 	if(r < 0){
+		/* no key - the packets go out scrambled (and not as a decrypt
+		   failure) until an ECM gets through the card again */
 		if(dec->m2 != NULL){
-			dec->m2->clear_scramble_key(dec->m2);
+			dec->m2->release(dec->m2);
+			dec->m2 = NULL;
 		}
-		r = ARIB_STD_B25_ERROR_ECM_PROC_FAILURE;
-		goto LAST;
+		return ARIB_STD_B25_ERROR_ECM_PROC_FAILURE;
 	}
 
-	if( (res.return_code != 0x0800) &&
-	    (res.return_code != 0x0400) &&
-	    (res.return_code != 0x0200) ){
+	if(!check_ecm_purchased(res)){
 		/* return_code is not equal "purchased" */
 		if(dec->m2 != NULL){
 			dec->m2->release(dec->m2);
 			dec->m2 = NULL;
 		}
 		dec->unpurchased += 1;
-		dec->last_error = res.return_code;
+		dec->last_error = res->return_code;
 		dec->locked += 1;
-		r = ARIB_STD_B25_WARN_UNPURCHASED_ECM;
-		goto LAST;
+		return ARIB_STD_B25_WARN_UNPURCHASED_ECM;
 	}
 
 	if(dec->m2 == NULL){
@@ -2118,31 +2617,52 @@ static int proc_ecm(DECRYPTOR_ELEM *dec, B_CAS_CARD *bcas, int32_t multi2_round)
 		dec->m2->set_round(dec->m2, multi2_round);
 	}
 
-	dec->m2->set_scramble_key(dec->m2, res.scramble_key);
+	dec->m2->set_scramble_key(dec->m2, res->scramble_key);
 
 #if defined(DEBUG)
 	int i;
 	fprintf(stderr, "----\n");
 	fprintf(stderr, "odd: ");
 	for(i=0;i<8;i++){
-		fprintf(stderr, " %02x", res.scramble_key[i]);
+		fprintf(stderr, " %02x", res->scramble_key[i]);
 	}
 	fprintf(stderr, "\n");
 	fprintf(stderr, "even:");
 	for(i=8;i<16;i++){
-		fprintf(stderr, " %02x", res.scramble_key[i]);
+		fprintf(stderr, " %02x", res->scramble_key[i]);
 	}
 	fprintf(stderr, "\n");
 	fflush(stderr);
 #endif
 
-LAST:
-	if(sect.raw != NULL){
-		n = dec->ecm->ret(dec->ecm, &sect);
-		if( (n < 0) && (r == 0) ){
-			r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
-		}
+	return 0;
+}
+
+static int check_ecm_purchased(B_CAS_ECM_RESULT *res)
+{
+	return (res->return_code == 0x0800) ||
+	       (res->return_code == 0x0400) ||
+	       (res->return_code == 0x0200);
+}
+
+/* a purchased answer is kept for whoever sends the same ECM next, the
+   cache failing is no error of the stream */
+static void store_ecm_result(ECM_CACHE *cache, int32_t table_id, uint32_t crc, uint8_t *data, uint32_t len, int r, B_CAS_ECM_RESULT *res)
+{
+	if( (cache == NULL) || (r < 0) || !check_ecm_purchased(res) ){
+		return;
 	}
+
+	cache->put(cache, table_id, crc, data, (int32_t)len, res);
+}
+
+static uint32_t get_section_crc(TS_SECTION *sect)
+{
+	uint8_t *p;
+
+	p = sect->tail - 4;
+
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
 }
 
 #if defined(DEBUG)
@@ -2184,6 +2704,21 @@ static void dump_pts(uint8_t *src, int32_t crypt)
 #endif
 
 static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r,n;
+
+	r = proc_packets(prv);
+
+	/* nothing may be handed out (or freed) under the workers */
+	n = wait_decrypt_jobs(prv);
+	if( (r >= 0) && (n < 0) ){
+		r = n;
+	}
+
+	return r;
+}
+
+static int proc_packets(ARIB_STD_B25_PRIVATE_DATA *prv)
 {
 	int r;
 	intptr_t m,n;
@@ -2195,15 +2730,29 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 	uint8_t *p;
 	uint8_t *curr;
 	uint8_t *tail;
+	uint8_t *out;
 
 	TS_HEADER hdr;
 	DECRYPTOR_ELEM *dec;
 	TS_PROGRAM *pgrm;
+	PID_SLOT *slot;
+
+	TS_PACKET_DESC desc[TS_PACKET_WINDOW];
+	TS_PACKET_DESC *d;
+	int32_t desc_count;
+	int32_t desc_next;
+	uint8_t *desc_curr;
+	int32_t slow;
+
+	int32_t in_place;
 
 	unit = prv->unit_size;
 	curr = prv->sbuf.head;
 	tail = prv->sbuf.tail;
 
+	/* put_in_place() lends the caller's buffer as both sbuf and dbuf */
+	in_place = (prv->sbuf.pool == prv->dbuf.pool) && (prv->sbuf.pool != NULL);
+
 	m = prv->dbuf.tail - prv->dbuf.head;
 	n = tail - curr;
 	if(!reserve_work_buffer(&(prv->dbuf), m+n)){
@@ -2212,43 +2761,100 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 
 	r = 0;
 
+	/* headers are read a window ahead; a resync or a broken packet moves
+	   curr off the window's stride and starts a new one */
+	desc_count = 0;
+	desc_next = 0;
+	desc_curr = NULL;
+	slow = 0;
+
 	while( (curr+unit) < tail ){
 
-		if( (curr[0] != 0x47) || (curr[unit] != 0x47) ){
+		if(in_place){
+			/* where put_in_place() resumes after a failure */
+			prv->sbuf.head = curr;
+		}
+
+		if( (desc_next >= desc_count) || (curr != desc_curr) ){
+			if(prv->ecm_count > 0){
+				/* keys the card thread has found meanwhile */
+				r = poll_ecm_jobs(prv, ECM_JOB_MAX);
+				if(r < 0){
+					return r;
+				}
+			}
+			desc_count = classify_packets(desc, curr, tail, unit);
+			desc_next = 0;
+		}
+		d = desc + desc_next;
+
+		if( (d->flags & TS_PACKET_FLAG_SYNC) == 0 ){
 			p = resync(curr, tail, unit);
 			if(p == NULL){
+				curr = resync_resume(curr, tail, unit);
 				goto LAST;
 			}
 			if((p-curr) >= (unit-188)){
+				if( in_place && !join_output(prv, p-(unit-188)) ){
+					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				}
 				if(!append_work_buffer(&(prv->dbuf), p-(unit-188), unit-188)){
 					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
 				}
 			}
 			curr = p;
+			desc_count = classify_packets(desc, curr, tail, unit);
+			desc_next = 0;
+			d = desc;
 		}
 
-		extract_ts_header(&hdr, curr);
-		crypt = hdr.transport_scrambling_control;
-		pid = hdr.pid;
-
-		if(hdr.transport_error_indicator != 0){
-			/* bit error - append output buffer without parsing */
-			if(!append_work_buffer(&(prv->dbuf), curr, unit)){
-				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		/* packets that need no section parsing go through in batches,
+		   the rest (and a batch whose decryption failed) one by one */
+		if(slow < 1){
+			m = proc_packet_run(prv, curr, d, desc_count-desc_next, in_place, &slow);
+			if(m < 0){
+				return (int)m;
 			}
-			goto NEXT;
+			if(m > 0){
+				curr += m * unit;
+				desc_next += (int32_t)m;
+				desc_curr = curr;
+				continue;
+			}
+		}else{
+			slow -= 1;
 		}
 
-		if( (pid == 0x1fff) && (prv->strip) ){
+		desc_next += 1;
+		desc_curr = curr + unit;
+
+		if( in_place && !join_output(prv, curr) ){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+
+		crypt = d->crypt;
+		pid = d->pid;
+		out = NULL;
+
+		if(d->flags & TS_PACKET_FLAG_ERROR){
+			/* bit error - append output buffer without parsing, behind
+			   the packets of its PID held before if there are */
+			if(!append_work_buffer(check_held_pid(prv, pid) ? &(prv->hbuf) : &(prv->dbuf), curr, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			goto NEXT;
+		}
+
+		if( (d->flags & TS_PACKET_FLAG_NULL) && (prv->strip) ){
 			/* strip null(padding) stream */
 			goto NEXT;
 		}
 
 		p = curr+4;
-		if(hdr.adaptation_field_control & 0x02){
+		if(d->flags & TS_PACKET_FLAG_ADAPTATION){
 			p += (p[0]+1);
 			n = 188 - (p-curr);
-			if( (n < 1) && ((n < 0) || (hdr.adaptation_field_control & 0x01)) ){
+			if( (n < 1) && ((n < 0) || (d->flags & TS_PACKET_FLAG_PAYLOAD)) ){
 				/* broken packet */
 				curr += 1;
 				continue;
@@ -2257,11 +2863,27 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			n = 188 - 4;
 		}
 
-		if(crypt != 0){
-			if(hdr.adaptation_field_control & 0x01){
+		slot = add_pid_slot(prv, pid);
+		if(slot == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+
+		if( check_held_pid(prv, pid) &&
+		    ((crypt == 0) || ((d->flags & TS_PACKET_FLAG_PAYLOAD) == 0)) ){
+			/* behind the packets of its PID held before (PCR ones too),
+			   counted as they go out */
+			if(crypt != 0){
+				curr[3] &= 0x3f;
+			}
+			if(!append_work_buffer(&(prv->hbuf), curr, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			out = prv->hbuf.tail - unit;
+		}else if(crypt != 0){
+			if(d->flags & TS_PACKET_FLAG_PAYLOAD){
 
 				if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
-					dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+					dec = (DECRYPTOR_ELEM *)(slot->target);
 				}else if( (prv->map[pid].type == 0) &&
 				          (prv->decrypt.count == 1) ){
 					dec = prv->decrypt.head;
@@ -2269,34 +2891,71 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 					dec = NULL;
 				}
 
+				if(check_hold_packet(prv, dec, crypt)){
+					add_held_pid(prv, pid);
+					if(check_key_ready(dec, crypt)){
+						/* held for the order only, the key may be
+						   gone by the time it goes out */
+						m = append_decrypted_packet(&(prv->hbuf), dec->m2, crypt, curr, (int32_t)(p-curr), (int32_t)n, unit);
+						if(m < 0){
+							return (int)m;
+						}
+						dec->crypt = crypt;
+					}else if(!append_work_buffer(&(prv->hbuf), curr, unit)){
+						return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+					}
+					goto NEXT;
+				}
+
 				if( (dec != NULL) && (dec->m2 != NULL) ){
-					m = dec->m2->decrypt(dec->m2, crypt, p, n);
+					/* decrypt straight into the output buffer */
+					m = append_decrypted_packet(&(prv->dbuf), dec->m2, crypt, curr, (int32_t)(p-curr), (int32_t)n, unit);
 					if(m < 0){
-						return ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+						return (int)m;
 					}
-					curr[3] &= 0x3f;
-					prv->map[pid].normal_packet += 1;
+					out = prv->dbuf.tail - unit;
+					dec->crypt = crypt;
+					slot->normal_packet += 1;
 				}else{
-					prv->map[pid].undecrypted += 1;
+					slot->undecrypted += 1;
 				}
 			}else{
 				curr[3] &= 0x3f;
-				prv->map[pid].normal_packet += 1;
+				slot->normal_packet += 1;
 			}
 		}else{
-			prv->map[pid].normal_packet += 1;
+			slot->normal_packet += 1;
+		}
+		if(out == NULL){
+			if(!append_work_buffer(&(prv->dbuf), curr, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			out = prv->dbuf.tail - unit;
 		}
+		/* parse the output copy, it holds the descrambled payload */
+		p = out + (p-curr);
 #if defined(DEBUG)
-		if( (hdr.payload_unit_start_indicator != 0) && (pid == 0x111) ){
-			dump_pts(curr, crypt);
+		if( (out[1] & 0x40) && (pid == 0x111) ){
+			dump_pts(out, crypt);
 		}
 #endif
-		if(!append_work_buffer(&(prv->dbuf), curr, unit)){
-			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+
+		if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
+			/* elementary stream, no section to parse */
+			goto NEXT;
+		}
+
+		/* a section may change a key or drop a decryptor in use */
+		r = wait_decrypt_jobs(prv);
+		if(r < 0){
+			return r;
 		}
 
+		/* the section parsers only look at pid and payload_unit_start_indicator */
+		extract_ts_header(&hdr, out);
+
 		if(prv->map[pid].type == PID_MAP_TYPE_ECM){
-			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+			dec = (DECRYPTOR_ELEM *)(slot->target);
 			if( (dec == NULL) || (dec->ecm == NULL) ){
 				/* this code will never execute */
 				return ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
@@ -2312,16 +2971,28 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(m == 0){
 				goto NEXT;
 			}
+			if( (prv->ecm_job != NULL) && (dec->m2 != NULL) ){
+				/* the key there goes on while the card works */
+				r = add_ecm_job(prv, dec);
+			}else{
+				/* the card is one thread's at a time */
+				r = poll_ecm_jobs(prv, 0);
+				if(r >= 0){
 #ifdef ENABLE_MULTI2_SIMD
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round, prv->simd_instruction);
+					r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round, prv->simd_instruction);
 #else
-			r = proc_ecm(dec, prv->bcas, prv->multi2_round);
+					r = proc_ecm(dec, prv->bcas, prv->ecm_cache, prv->multi2_round);
 #endif
+				}
+				if(r >= 0){
+					r = decrypt_held_packets(prv);
+				}
+			}
 			if(r < 0){
 				return r;
 			}
 		}else if(prv->map[pid].type == PID_MAP_TYPE_PMT){
-			pgrm = (TS_PROGRAM *)(prv->map[pid].target);
+			pgrm = (TS_PROGRAM *)(slot->target);
 			if( (pgrm == NULL) || (pgrm->pmt == NULL) ){
 				/* this code will never execute */
 				return ARIB_STD_B25_ERROR_PMT_PARSE_FAILURE;
@@ -2410,28 +3081,1355 @@ static int proc_arib_std_b25(ARIB_STD_B25_PRIVATE_DATA *prv)
 			if(r < 0){
 				return r;
 			}
+			if(prv->holding){
+				/* the PMTs and ECMs are parsed as they come */
+				goto NEXT;
+			}
 			curr += unit;
 			goto LAST;
 		}
 
-	NEXT:
-		curr += unit;
+	NEXT:
+		curr += unit;
+	}
+
+LAST:
+	if(in_place){
+		/* put_in_place() carries the rest over */
+		prv->sbuf.head = curr;
+		return r;
+	}
+
+	consume_work_buffer(&(prv->sbuf), curr);
+
+	return r;
+}
+
+/* handles packets from curr on that go to no section parser, up to the
+   first one that does (or a broken one) - all scrambled payloads of the
+   run are decrypted with one decrypt_batch() call before anything is
+   output, or by a worker thread if there are any. returns the number of
+   packets done, 0 if curr is not such a packet or the decryption failed;
+   then *slow tells how many packets to leave to the packet by packet
+   loop */
+static int32_t proc_packet_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *curr, TS_PACKET_DESC *desc, int32_t count, int32_t in_place, int32_t *slow)
+{
+	int32_t i,k,n;
+	int32_t unit;
+	int32_t type;
+	int32_t pid;
+	int32_t queued;
+
+	uint8_t *p;
+	uint8_t *out;
+	intptr_t base;
+
+	DECRYPTOR_ELEM *dec;
+	MULTI2 *m2;
+	PID_SLOT *slot;
+
+	MULTI2_BATCH_ENTRY ent[TS_PACKET_WINDOW];
+	uint8_t *hdr[TS_PACKET_WINDOW];
+	int32_t offset[TS_PACKET_WINDOW];
+	uint8_t action[TS_PACKET_WINDOW];
+
+	unit = prv->unit_size;
+	m2 = NULL;
+
+	/* 1st step, plan the run without touching anything */
+	k = 0;
+	for(n=0;n<count;n++){
+		if( (desc[n].flags & TS_PACKET_FLAG_SYNC) == 0 ){
+			break;
+		}
+		pid = desc[n].pid;
+		type = prv->map[pid].type;
+		if( (type == PID_MAP_TYPE_ECM) || (type == PID_MAP_TYPE_PMT) ||
+		    (type == PID_MAP_TYPE_EMM) || (pid == 0x0001) || (pid == 0x0000) ){
+			if( (desc[n].flags & TS_PACKET_FLAG_ERROR) == 0 ){
+				break;
+			}
+		}
+		if(check_held_pid(prv, pid)){
+			/* the packet by packet loop puts it behind the held ones */
+			break;
+		}
+
+		p = curr + n*unit;
+		if(desc[n].flags & TS_PACKET_FLAG_ERROR){
+			action[n] = TS_PACKET_ACTION_COPY;
+			continue;
+		}
+		if( (desc[n].flags & TS_PACKET_FLAG_NULL) && (prv->strip) ){
+			action[n] = TS_PACKET_ACTION_STRIP;
+			continue;
+		}
+
+		offset[n] = 4;
+		if(desc[n].flags & TS_PACKET_FLAG_ADAPTATION){
+			offset[n] += p[4]+1;
+			i = 188 - offset[n];
+			if( (i < 1) && ((i < 0) || (desc[n].flags & TS_PACKET_FLAG_PAYLOAD)) ){
+				/* broken packet */
+				break;
+			}
+		}
+
+		if(desc[n].crypt == 0){
+			action[n] = TS_PACKET_ACTION_CLEAR;
+			continue;
+		}
+		if( (desc[n].flags & TS_PACKET_FLAG_PAYLOAD) == 0 ){
+			action[n] = TS_PACKET_ACTION_NO_PAYLOAD;
+			continue;
+		}
+
+		if(type == PID_MAP_TYPE_OTHER){
+			dec = (DECRYPTOR_ELEM *)(find_pid_slot(prv, pid)->target);
+		}else if( (type == 0) && (prv->decrypt.count == 1) ){
+			dec = prv->decrypt.head;
+		}else{
+			dec = NULL;
+		}
+
+		if(check_hold_packet(prv, dec, desc[n].crypt)){
+			/* held by the packet by packet loop */
+			break;
+		}
+		if( (dec == NULL) || (dec->m2 == NULL) ){
+			action[n] = TS_PACKET_ACTION_NO_KEY;
+			continue;
+		}
+		if( (m2 != NULL) && (m2 != dec->m2) ){
+			/* the next run takes the other decryptor */
+			break;
+		}
+		m2 = dec->m2;
+		dec->crypt = desc[n].crypt;
+
+		action[n] = TS_PACKET_ACTION_DECRYPT;
+		ent[k].size = 188 - offset[n];
+		ent[k].type = desc[n].crypt;
+		k += 1;
+	}
+
+	if(n < 1){
+		return 0;
+	}
+
+	/* 2nd step, decrypt where the packets end up - in place that is
+	   where they are, otherwise the copies in dbuf */
+	base = prv->dbuf.tail - prv->dbuf.pool;
+	if(!in_place){
+		for(i=0;i<n;i++){
+			if(action[i] == TS_PACKET_ACTION_STRIP){
+				continue;
+			}
+			if(!append_work_buffer(&(prv->dbuf), curr+i*unit, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+		}
+	}
+
+	k = 0;
+	out = in_place ? curr : (prv->dbuf.pool + base);
+	for(i=0;i<n;i++){
+		if(action[i] == TS_PACKET_ACTION_DECRYPT){
+			ent[k].data = out + offset[i];
+			hdr[k] = out;
+			k += 1;
+		}
+		if( in_place || (action[i] != TS_PACKET_ACTION_STRIP) ){
+			out += unit;
+		}
+	}
+
+	queued = 0;
+	if( (k > 0) && (prv->worker_count > 0) ){
+		/* dbuf holds all of sbuf (see proc_packets()), so it does not
+		   move before proc_arib_std_b25() waits for the job */
+		add_decrypt_job(prv, m2, ent, hdr, k);
+		queued = 1;
+	}else if( (k > 0) && (m2->decrypt_batch(m2, ent, k) < 0) ){
+		/* let the packet by packet loop fail at the right packet */
+		prv->dbuf.tail = prv->dbuf.pool + base;
+		*slow = n - 1;
+		return 0;
+	}
+
+	/* 3rd step, output and count */
+	out = in_place ? curr : (prv->dbuf.pool + base);
+	for(i=0;i<n;i++){
+		p = curr + i*unit;
+		if(in_place){
+			/* where put_in_place() resumes after a failure */
+			prv->sbuf.head = p;
+			if(!join_output(prv, p)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+		}
+		if(action[i] == TS_PACKET_ACTION_STRIP){
+			if(in_place){
+				out += unit;
+			}
+			continue;
+		}
+		if(in_place){
+			if(!append_work_buffer(&(prv->dbuf), p, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+		}
+
+		if( (action[i] == TS_PACKET_ACTION_NO_PAYLOAD) ||
+		    ((action[i] == TS_PACKET_ACTION_DECRYPT) && !queued) ){
+			/* transport_scrambling_control = 0 */
+			out[3] &= 0x3f;
+		}
+
+		if(action[i] != TS_PACKET_ACTION_COPY){
+			slot = add_pid_slot(prv, desc[i].pid);
+			if(slot == NULL){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			if(action[i] == TS_PACKET_ACTION_NO_KEY){
+				slot->undecrypted += 1;
+			}else{
+				slot->normal_packet += 1;
+			}
+		}
+#if defined(DEBUG)
+		if( (out[1] & 0x40) && (desc[i].pid == 0x111) && !queued ){
+			dump_pts(out, desc[i].crypt);
+		}
+#endif
+		out += unit;
+	}
+
+	return n;
+}
+
+static int check_proc_ready(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	if(prv->unit_size < 188){
+		return 0;
+	}
+
+	if(prv->p_count < 1){
+		return 0;
+	}
+
+	return check_pmt_complete(prv) && check_ecm_complete(prv);
+}
+
+static int put_buffer(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf)
+{
+	if( prv->in_place && check_proc_ready(prv) ){
+		return put_in_place(prv, buf);
+	}
+
+	return put_work_buffer(prv, buf, 1);
+}
+
+static int put_work_buffer(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf, int32_t count)
+{
+	int r,i;
+	intptr_t slen,dlen,hlen;
+	uint8_t *head;
+
+	head = prv->sbuf.head;
+	slen = prv->sbuf.tail - prv->sbuf.head;
+	dlen = prv->dbuf.tail - prv->dbuf.head;
+	hlen = prv->hbuf.tail - prv->hbuf.head;
+
+	for(i=0;i<count;i++){
+		if(!append_work_buffer(&(prv->sbuf), buf[i].data, (int32_t)buf[i].size)){	// cast
+			prv->sbuf.tail = prv->sbuf.head + slen;
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+
+	if(prv->unit_size < 188){
+		r = select_unit_size(prv);
+		if(r < 0){
+			return r;
+		}
+		if(prv->unit_size < 188){
+			/* need more data */
+			return 0;
+		}
+	}
+
+	if( (prv->hold_max > 0) && !check_proc_ready(prv) ){
+		r = put_low_latency(prv);
+		if(r < 0){
+			/* rollback */
+			prv->sbuf.head = head;
+			prv->sbuf.tail = prv->sbuf.head + slen;
+			prv->dbuf.tail = prv->dbuf.head + dlen;
+			prv->hbuf.tail = prv->hbuf.head + hlen;
+		}
+		return r;
+	}
+
+	if(prv->p_count < 1){
+		r = find_pat(prv);
+		if(r < 0){
+			return r;
+		}
+		if(prv->p_count < 1){
+			if(prv->sbuf_offset < (16*1024*1024)){
+				/* need more data */
+				return ARIB_STD_B25_WARN_PAT_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_PAT_IN_HEAD_16M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	if(!check_pmt_complete(prv)){
+		r = find_pmt(prv);
+		if(r < 0){
+			return r;
+		}
+		if(!check_pmt_complete(prv)){
+			if(prv->sbuf_offset < (32*1024*1024)){
+				/* need more data */
+				return ARIB_STD_B25_WARN_PMT_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_PMT_IN_HEAD_32M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	if(!check_ecm_complete(prv)){
+		r = find_ecm(prv);
+		if(r < 0){
+			return r;
+		}
+		if(!check_ecm_complete(prv)){
+			if(prv->sbuf_offset < (32*1024*1024)){
+				/* need more data */
+				return ARIB_STD_B25_WARN_ECM_NOT_COMPLETE;
+			}else{
+				/* exceed sbuf limit */
+				return ARIB_STD_B25_ERROR_NO_ECM_IN_HEAD_32M;
+			}
+		}
+		prv->sbuf_offset = 0;
+	}
+
+	r = proc_arib_std_b25(prv);
+	if(r >= 0){
+		i = release_ecm_held(prv);
+		if(i < 0){
+			r = i;
+		}
+	}
+	if(r < 0){
+		/* rollback */
+		prv->sbuf.head = head;
+		prv->sbuf.tail = prv->sbuf.head + slen;
+		prv->dbuf.tail = prv->dbuf.head + dlen;
+		prv->hbuf.tail = prv->hbuf.head + hlen;
+	}
+	return r;
+}
+
+/* startup without buffering - the pass parses PAT, PMTs and ECMs as they
+   come, scrambled packets wait in hbuf and so does every packet of their
+   PID after them, the rest go out at once. those whose key is there
+   leave after the pass, all of them once the startup is complete or a
+   limit of set_low_latency() is exceeded. the limits are checked per
+   put, so hbuf may go over by one put */
+static int put_low_latency(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r,n;
+
+	prv->sbuf_offset = 0;
+
+	prv->holding = 1;
+	r = proc_arib_std_b25(prv);
+	prv->holding = 0;
+	if(r < 0){
+		return r;
+	}
+
+	n = poll_ecm_jobs(prv, ECM_JOB_MAX);
+	if(n < 0){
+		return n;
+	}
+
+	if( check_proc_ready(prv) || check_hold_expired(prv) ){
+		n = release_held_packets(prv, 1);
+	}else{
+		n = release_held_packets(prv, 0);
+	}
+	if(n < 0){
+		return n;
+	}
+
+	return r;
+}
+
+/* moves held packets to dbuf in the order they came, those decrypted
+   by now. all - also the rest, as they are, once the card thread is
+   done */
+static int release_held_packets(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t all)
+{
+	int r;
+	int32_t unit;
+	int32_t pid;
+
+	uint32_t kept[0x2000/32];
+
+	uint8_t *p;
+	uint8_t *curr;
+	uint8_t *tail;
+	uint8_t *keep;
+
+	PID_SLOT *slot;
+
+	if(prv->hbuf.tail == prv->hbuf.head){
+		return 0;
+	}
+
+	if(all){
+		r = poll_ecm_jobs(prv, 0);
+		if(r < 0){
+			return r;
+		}
+	}
+
+	/* a PMT may have brought a key along */
+	r = decrypt_held_packets(prv);
+	if(r < 0){
+		return r;
+	}
+
+	unit = prv->unit_size;
+	curr = prv->hbuf.head;
+	tail = prv->hbuf.tail;
+	keep = curr;
+
+	/* a PID with a packet kept keeps the ones after it as well */
+	memset(kept, 0, sizeof(kept));
+
+	if(!reserve_work_buffer(&(prv->dbuf), (prv->dbuf.tail - prv->dbuf.head) + (tail - curr))){
+		return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	for(;curr<tail;curr+=unit){
+		pid = ((curr[1] << 8) | curr[2]) & 0x1fff;
+
+		slot = add_pid_slot(prv, pid);
+		if(slot == NULL){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+
+		if( ((curr[3] & 0xc0) == 0) || (curr[1] & 0x80) ){
+			if( ((kept[pid >> 5] >> (pid & 31)) & 1) == 0 ){
+				if(!append_work_buffer(&(prv->dbuf), curr, unit)){
+					return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+				}
+				if((curr[1] & 0x80) == 0){
+					/* bit errors are not counted */
+					slot->normal_packet += 1;
+				}
+				continue;
+			}
+		}else if(all){
+			if(!append_work_buffer(&(prv->dbuf), curr, unit)){
+				return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			}
+			slot->undecrypted += 1;
+			continue;
+		}
+
+		kept[pid >> 5] |= 1u << (pid & 31);
+		p = keep;
+		keep += unit;
+		if(p != curr){
+			memcpy(p, curr, unit);
+		}
+	}
+
+	/* what is kept stays the oldest, hold_since is left as is */
+	prv->hbuf.tail = keep;
+	memcpy(prv->held, kept, sizeof(kept));
+
+	return 0;
+}
+
+/* decrypts in hbuf the held packets there is a key for now. run as soon
+   as a key changes, held packets must not see the one after theirs */
+static int decrypt_held_packets(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r;
+	int32_t unit;
+	int32_t offset;
+	int32_t crypt;
+
+	uint8_t *curr;
+	uint8_t *tail;
+
+	DECRYPTOR_ELEM *dec;
+
+	unit = prv->unit_size;
+	curr = prv->hbuf.head;
+	tail = prv->hbuf.tail;
+
+	for(;curr<tail;curr+=unit){
+		crypt = (curr[3] >> 6) & 3;
+		if( (crypt == 0) || (curr[1] & 0x80) ){
+			/* bit errors go out as they are */
+			continue;
+		}
+
+		dec = find_held_decryptor(prv, ((curr[1] << 8) | curr[2]) & 0x1fff);
+		if(!check_key_ready(dec, crypt)){
+			continue;
+		}
+
+		/* only scrambled packets with a payload and no broken
+		   adaptation field are held scrambled */
+		offset = 4;
+		if(curr[3] & 0x20){
+			offset += curr[4]+1;
+		}
+		r = dec->m2->decrypt_to(dec->m2, crypt, curr+offset, curr+offset, 188-offset);
+		if(r < 0){
+			return ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+		}
+		/* transport_scrambling_control = 0 */
+		curr[3] &= 0x3f;
+		dec->crypt = crypt;
+	}
+
+	return 0;
+}
+
+static DECRYPTOR_ELEM *find_held_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	PID_SLOT *slot;
+
+	if(prv->map[pid].type == PID_MAP_TYPE_OTHER){
+		slot = find_pid_slot(prv, pid);
+		return (slot != NULL) ? (DECRYPTOR_ELEM *)(slot->target) : NULL;
+	}
+	if( (prv->map[pid].type == 0) && (prv->decrypt.count == 1) ){
+		return prv->decrypt.head;
+	}
+
+	return NULL;
+}
+
+/* whether the key in place is the one for a packet of that parity */
+static int check_key_ready(DECRYPTOR_ELEM *dec, int32_t crypt)
+{
+	if( (dec == NULL) || (dec->m2 == NULL) ){
+		return 0;
+	}
+
+	/* the card thread is after the key of the other parity */
+	return (dec->ecm_busy == 0) || (crypt == dec->ecm_crypt);
+}
+
+static int check_hold_expired(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	if(prv->hbuf.tail == prv->hbuf.head){
+		return 0;
+	}
+
+	if( (prv->hbuf.tail - prv->hbuf.head) > prv->hold_max ){
+		return 1;
+	}
+
+	if( (prv->hold_msec > 0) &&
+	    ((get_msec() - prv->hold_since) >= prv->hold_msec) ){
+		return 1;
+	}
+
+	return 0;
+}
+
+/* whether a scrambled packet waits in hbuf */
+static int check_hold_packet(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec, int32_t crypt)
+{
+	if(prv->hbuf.tail != prv->hbuf.head){
+		/* behind the ones held before */
+		return 1;
+	}
+
+	if( (dec == NULL) || (dec->m2 == NULL) ){
+		/* low-latency start */
+		return prv->holding;
+	}
+
+	return !check_key_ready(dec, crypt);
+}
+
+/* whether a packet of pid must go behind the ones held before */
+static int check_held_pid(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	if(prv->hbuf.tail == prv->hbuf.head){
+		return 0;
+	}
+
+	return (prv->held[pid >> 5] >> (pid & 31)) & 1;
+}
+
+/* called before a packet of pid goes to hbuf */
+static void add_held_pid(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	if(prv->hbuf.tail == prv->hbuf.head){
+		prv->hold_since = get_msec();
+		memset(prv->held, 0, sizeof(prv->held));
+	}
+
+	prv->held[pid >> 5] |= 1u << (pid & 31);
+}
+
+/* descrambles and strips inside buf->data, only what is left of a packet
+   at the end of the buffer goes through sbuf/dbuf. on failure buf is
+   narrowed to the input that was not processed */
+static int put_in_place(ARIB_STD_B25_PRIVATE_DATA *prv, ARIB_STD_B25_BUFFER *buf)
+{
+	int r;
+	intptr_t c,k,n,off;
+
+	uint8_t *data;
+	uint8_t *rest;
+
+	ARIB_STD_B25_BUFFER part;
+	TS_WORK_BUFFER sbuf;
+	TS_WORK_BUFFER dbuf;
+
+	data = buf->data;
+	n = buf->size;
+	off = 0;
+
+	r = 0;
+
+	k = prv->sbuf.tail - prv->sbuf.head;
+	if(k > 0){
+		/* complete the carried packet with the head of the new data,
+		   enough for the sync check of the following one */
+		if(k < prv->unit_size){
+			c = prv->unit_size - k + 1;
+		}else{
+			c = prv->unit_size * 9;
+		}
+		if(c > n){
+			c = n;
+		}
+		part.data = data;
+		part.size = (uint32_t)c;
+		r = put_work_buffer(prv, &part, 1);
+		if(r < 0){
+			return r;
+		}
+		k = prv->sbuf.tail - prv->sbuf.head;
+		if( (k > c) || !check_proc_ready(prv) ){
+			/* resync or PSI change pending - take the rest the usual way */
+			part.data = data+c;
+			part.size = (uint32_t)(n-c);
+			r = put_work_buffer(prv, &part, 1);
+			if(r < 0){
+				*buf = part;
+			}
+			return r;
+		}
+		/* the unprocessed bytes all came from buf->data */
+		reset_work_buffer(&(prv->sbuf));
+		off = c - k;
+	}
+
+	if(off >= n){
+		return r;
+	}
+
+	/* what is in dbuf so far goes before the runs to come */
+	k = prv->dbuf.tail - prv->dbuf.head;
+	if(k > prv->run_dbuf){
+		if(!add_output_run(prv, NULL, prv->run_dbuf, k - prv->run_dbuf)){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->run_dbuf = k;
+	}
+
+	/* borrow buf->data for both sides, every packet is output where it
+	   is and holes between them start new runs */
+	sbuf = prv->sbuf;
+	dbuf = prv->dbuf;
+
+	prv->sbuf.pool = data;
+	prv->sbuf.head = data+off;
+	prv->sbuf.tail = data+n;
+	prv->sbuf.max = (int32_t)n;
+	prv->sbuf.ring = RING_BUFFER_OFF;
+
+	prv->dbuf.pool = data;
+	prv->dbuf.head = data+off;
+	prv->dbuf.tail = data+off;
+	prv->dbuf.max = (int32_t)n;
+	prv->dbuf.ring = RING_BUFFER_OFF;
+
+	r = proc_arib_std_b25(prv);
+
+	/* after a failure sbuf.head is the packet it happened in */
+	rest = prv->sbuf.head;
+	if(!close_output_run(prv, (r < 0) ? rest : prv->dbuf.tail)){
+		/* the unrecorded run is output as it is */
+		rest = prv->dbuf.head;
+		r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	prv->sbuf = sbuf;
+	prv->dbuf = dbuf;
+
+	if(r >= 0){
+		/* after the runs */
+		r = release_ecm_held(prv);
+	}
+
+	if( (r >= 0) && !append_work_buffer(&(prv->sbuf), rest, (int32_t)((data+n)-rest)) ){
+		r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	if(r < 0){
+		buf->data = rest;
+		buf->size = (uint32_t)((data+n)-rest);
+	}
+
+	return r;
+}
+
+/* in place every packet stays where it is, so output that does not
+   continue the current run closes it and starts a new one at data */
+static int join_output(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *data)
+{
+	if(prv->dbuf.tail == data){
+		return 1;
+	}
+
+	if(!close_output_run(prv, prv->dbuf.tail)){
+		return 0;
+	}
+
+	prv->dbuf.head = data;
+	prv->dbuf.tail = data;
+
+	return 1;
+}
+
+/* records dbuf.head up to tail (but not past dbuf.tail) as a run */
+static int close_output_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *tail)
+{
+	if(tail > prv->dbuf.tail){
+		tail = prv->dbuf.tail;
+	}
+	if(tail <= prv->dbuf.head){
+		return 1;
+	}
+
+	return add_output_run(prv, prv->dbuf.head, 0, tail - prv->dbuf.head);
+}
+
+static int add_output_run(ARIB_STD_B25_PRIVATE_DATA *prv, uint8_t *data, intptr_t offset, intptr_t size)
+{
+	OUTPUT_RUN *run;
+
+	run = (OUTPUT_RUN *)reserve_array(prv->run, &(prv->run_max), prv->run_count+1, sizeof(OUTPUT_RUN));
+	if(run == NULL){
+		return 0;
+	}
+	prv->run = run;
+
+	run += prv->run_count;
+	run->data = data;
+	run->offset = offset;
+	run->size = (uint32_t)size;	// cast
+
+	prv->run_count += 1;
+
+	return 1;
+}
+
+/* appends the runs and the rest of dbuf to iov, in that order */
+static int collect_output(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t i;
+	intptr_t m;
+
+	OUTPUT_RUN *run;
+	ARIB_STD_B25_BUFFER *v;
+
+	m = prv->dbuf.tail - prv->dbuf.head;
+
+	v = (ARIB_STD_B25_BUFFER *)reserve_array(prv->iov, &(prv->iov_max), prv->iov_count+prv->run_count+1, sizeof(ARIB_STD_B25_BUFFER));
+	if(v == NULL){
+		return 0;
+	}
+	prv->iov = v;
+
+	v += prv->iov_count;
+	for(i=0;i<prv->run_count;i++){
+		run = prv->run + i;
+		v->data = (run->data != NULL) ? run->data : prv->dbuf.head + run->offset;
+		v->size = run->size;
+		v += 1;
+	}
+	if(m > prv->run_dbuf){
+		v->data = prv->dbuf.head + prv->run_dbuf;
+		v->size = (uint32_t)(m - prv->run_dbuf);	// cast
+		v += 1;
+	}
+
+	prv->iov_count = (int32_t)(v - prv->iov);
+	prv->run_count = 0;
+	prv->run_dbuf = 0;
+
+	/* still valid until the next put() */
+	reset_work_buffer(&(prv->dbuf));
+
+	return 1;
+}
+
+static void *reserve_array(void *array, int32_t *max, int32_t count, size_t size)
+{
+	int32_t n;
+
+	if( (array != NULL) && (*max >= count) ){
+		return array;
+	}
+
+	n = (*max < 64) ? 64 : (*max * 2);
+	while(n < count){
+		n += n;
+	}
+
+	array = realloc(array, size*n);
+	if(array != NULL){
+		*max = n;
+	}
+
+	return array;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ ECM card thread
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static int start_ecm_thread(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	prv->ecm_job = (ECM_JOB *)calloc(ECM_JOB_MAX, sizeof(ECM_JOB));
+	if(prv->ecm_job == NULL){
+		return 0;
+	}
+
+	if(!thread_mutex_init(&(prv->ecm_lock))){
+		goto ERROR;
+	}
+	if(!thread_cond_init(&(prv->ecm_added))){
+		thread_mutex_destroy(&(prv->ecm_lock));
+		goto ERROR;
+	}
+	if(!thread_cond_init(&(prv->ecm_done))){
+		thread_cond_destroy(&(prv->ecm_added));
+		thread_mutex_destroy(&(prv->ecm_lock));
+		goto ERROR;
+	}
+
+	prv->ecm_head = 0;
+	prv->ecm_count = 0;
+	prv->ecm_taken = 0;
+	prv->ecm_quit = 0;
+
+	if(!thread_create(&(prv->ecm_thread), ecm_worker, prv)){
+		thread_cond_destroy(&(prv->ecm_done));
+		thread_cond_destroy(&(prv->ecm_added));
+		thread_mutex_destroy(&(prv->ecm_lock));
+		goto ERROR;
+	}
+
+	return 1;
+
+ERROR:
+	free(prv->ecm_job);
+	prv->ecm_job = NULL;
+	return 0;
+}
+
+/* results not taken in by poll_ecm_jobs() are dropped */
+static void stop_ecm_thread(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t i;
+	ECM_JOB *job;
+
+	if(prv->ecm_job == NULL){
+		return;
+	}
+
+	thread_mutex_lock(&(prv->ecm_lock));
+	prv->ecm_quit = 1;
+	thread_cond_signal(&(prv->ecm_added));
+	thread_mutex_unlock(&(prv->ecm_lock));
+
+	thread_join(&(prv->ecm_thread));
+
+	for(i=0;i<prv->ecm_count;i++){
+		job = prv->ecm_job + ((prv->ecm_head + i) % ECM_JOB_MAX);
+		if(job->dec != NULL){
+			job->dec->ecm_busy -= 1;
+		}
+	}
+
+	thread_cond_destroy(&(prv->ecm_done));
+	thread_cond_destroy(&(prv->ecm_added));
+	thread_mutex_destroy(&(prv->ecm_lock));
+
+	free(prv->ecm_job);
+	prv->ecm_job = NULL;
+	prv->ecm_count = 0;
+}
+
+static THREAD_RESULT THREAD_CALL ecm_worker(void *arg)
+{
+	int r;
+
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+	B_CAS_CARD *bcas;
+	B_CAS_ECM_RESULT res;
+	ECM_JOB *job;
+
+	prv = (ARIB_STD_B25_PRIVATE_DATA *)arg;
+
+	thread_mutex_lock(&(prv->ecm_lock));
+	while(1){
+		while( (prv->ecm_taken >= prv->ecm_count) && !prv->ecm_quit ){
+			thread_cond_wait(&(prv->ecm_added), &(prv->ecm_lock));
+		}
+		if(prv->ecm_quit){
+			break;
+		}
+		job = prv->ecm_job + ((prv->ecm_head + prv->ecm_taken) % ECM_JOB_MAX);
+		prv->ecm_taken += 1;
+		bcas = prv->bcas;
+		thread_mutex_unlock(&(prv->ecm_lock));
+
+		/* data and len stay as they are until the job is done */
+		memset(&res, 0, sizeof(res));
+		r = bcas->proc_ecm(bcas, &res, job->data, job->len);
+
+		thread_mutex_lock(&(prv->ecm_lock));
+		job->r = r;
+		job->res = res;
+		job->done = 1;
+		thread_cond_broadcast(&(prv->ecm_done));
+	}
+	thread_mutex_unlock(&(prv->ecm_lock));
+
+	return THREAD_RETURN;
+}
+
+/* queues the ECM section dec->ecm has ready, the current key of dec stays
+   until poll_ecm_jobs() sets the card's answer */
+static int add_ecm_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
+{
+	int r,n;
+	uint32_t len;
+	uint32_t crc;
+
+	ECM_JOB *job;
+	TS_SECTION sect;
+	B_CAS_ECM_RESULT res;
+
+	r = 0;
+	memset(&sect, 0, sizeof(sect));
+
+	if(prv->bcas == NULL){
+		r = ARIB_STD_B25_ERROR_EMPTY_B_CAS_CARD;
+		goto LAST;
+	}
+
+	n = dec->ecm->get(dec->ecm, &sect);
+	if(n < 0){
+		r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
+		goto LAST;
+	}
+	if(sect.hdr.table_id != TS_SECTION_ID_ECM_S){
+		r = ARIB_STD_B25_WARN_TS_SECTION_ID_MISSMATCH;
+		goto LAST;
+	}
+
+	if(dec->locked){
+		/* as in proc_ecm() */
+		dec->unpurchased += 1;
+		r = ARIB_STD_B25_WARN_UNPURCHASED_ECM;
+		goto LAST;
+	}
+
+	len = (uint32_t)(sect.tail - sect.data) - 4;	// cast
+	if(len > sizeof(job->data)){
+		r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
+		goto LAST;
+	}
+	crc = get_section_crc(&sect);
+
+	if( (prv->ecm_cache != NULL) &&
+	    (prv->ecm_cache->get(prv->ecm_cache, sect.hdr.table_id, crc, sect.data, len, &res) > 0) ){
+		/* known answer, the key is set here as proc_ecm() would */
+		r = (dec->ecm_busy > 0) ? poll_ecm_jobs(prv, 0) : 0;
+		r = (r < 0) ? r : wait_decrypt_jobs(prv);
+		if(r < 0){
+			goto LAST;
+		}
+#ifdef ENABLE_MULTI2_SIMD
+		r = set_ecm_result(dec, prv->bcas, prv->multi2_round, prv->simd_instruction, 0, &res);
+#else
+		r = set_ecm_result(dec, prv->bcas, prv->multi2_round, 0, &res);
+#endif
+		if(r >= 0){
+			r = decrypt_held_packets(prv);
+		}
+		goto LAST;
+	}
+
+	/* room for one more. what is held has only the parity of the last
+	   ECM told apart, a second one waits for the card */
+	r = poll_ecm_jobs(prv, (dec->ecm_busy > 0) ? 0 : ECM_JOB_MAX-1);
+	if(r < 0){
+		goto LAST;
+	}
+
+	thread_mutex_lock(&(prv->ecm_lock));
+	job = prv->ecm_job + ((prv->ecm_head + prv->ecm_count) % ECM_JOB_MAX);
+	job->dec = dec;
+	job->done = 0;
+	job->table_id = sect.hdr.table_id;
+	job->crc = crc;
+	job->len = len;
+	memcpy(job->data, sect.data, len);
+	prv->ecm_count += 1;
+	thread_cond_signal(&(prv->ecm_added));
+	thread_mutex_unlock(&(prv->ecm_lock));
+
+	dec->ecm_crypt = dec->crypt;
+	dec->ecm_busy += 1;
+
+LAST:
+	if(sect.raw != NULL){
+		n = dec->ecm->ret(dec->ecm, &sect);
+		if( (n < 0) && (r == 0) ){
+			r = ARIB_STD_B25_ERROR_ECM_PARSE_FAILURE;
+		}
+	}
+
+	return r;
+}
+
+/* sets the keys of the finished jobs in queue order, waiting while more
+   than max are left. returns the first error among them */
+static int poll_ecm_jobs(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t max)
+{
+	int r,n;
+
+	ECM_JOB *job;
+	DECRYPTOR_ELEM *dec;
+	B_CAS_ECM_RESULT res;
+
+	if(prv->ecm_job == NULL){
+		return 0;
+	}
+
+	r = 0;
+
+	thread_mutex_lock(&(prv->ecm_lock));
+	while(prv->ecm_count > 0){
+		job = prv->ecm_job + prv->ecm_head;
+		if(!job->done){
+			if(prv->ecm_count <= max){
+				break;
+			}
+			thread_cond_wait(&(prv->ecm_done), &(prv->ecm_lock));
+			continue;
+		}
+		dec = job->dec;
+		n = job->r;
+		res = job->res;
+		prv->ecm_head = (prv->ecm_head + 1) % ECM_JOB_MAX;
+		prv->ecm_count -= 1;
+		prv->ecm_taken -= 1;
+		thread_mutex_unlock(&(prv->ecm_lock));
+
+		/* the slot is only reused by add_ecm_job() on this thread */
+		store_ecm_result(prv->ecm_cache, job->table_id, job->crc, job->data, job->len, n, &res);
+
+		if(dec != NULL){
+			dec->ecm_busy -= 1;
+			/* the decrypt workers may have the old key in use */
+			r = (r < 0) ? r : wait_decrypt_jobs(prv);
+#ifdef ENABLE_MULTI2_SIMD
+			n = set_ecm_result(dec, prv->bcas, prv->multi2_round, prv->simd_instruction, n, &res);
+#else
+			n = set_ecm_result(dec, prv->bcas, prv->multi2_round, n, &res);
+#endif
+			if(n == ARIB_STD_B25_ERROR_ECM_PROC_FAILURE){
+				/* sent again as it comes next, see proc_ecm() */
+				dec->ecm->reset(dec->ecm);
+			}
+			if( (n < 0) && (r == 0) ){
+				r = n;
+			}
+			/* before the next job changes it again */
+			n = decrypt_held_packets(prv);
+			if( (n < 0) && (r == 0) ){
+				r = n;
+			}
+		}
+
+		thread_mutex_lock(&(prv->ecm_lock));
+	}
+	thread_mutex_unlock(&(prv->ecm_lock));
+
+	return r;
+}
+
+/* after a pass, what the keys found by now free goes out of hbuf. past
+   ecm_hold_max the card is waited for */
+static int release_ecm_held(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r;
+
+	if(prv->ecm_job == NULL){
+		return 0;
+	}
+
+	r = poll_ecm_jobs(prv, ECM_JOB_MAX);
+	if(r < 0){
+		return r;
+	}
+
+	if( (prv->hbuf.tail - prv->hbuf.head) > prv->ecm_hold_max ){
+		return release_held_packets(prv, 1);
+	}
+
+	return release_held_packets(prv, 0);
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ decrypt worker threads
+
+ proc_packet_run() queues the scrambled payloads of a run as a job right
+ where they are in the output, so the output order is the input order no
+ matter which worker finishes first. keys only change (and decryptors
+ only go away) in section processing, which waits for all jobs first -
+ every job thus uses the keys current at its packets
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static int start_workers(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t count)
+{
+	int32_t i;
+
+	prv->job_max = count * 4;
+	prv->job = (DECRYPT_JOB *)calloc(prv->job_max, sizeof(DECRYPT_JOB));
+	prv->worker = (THREAD *)calloc(count, sizeof(THREAD));
+	if( (prv->job == NULL) || (prv->worker == NULL) ){
+		goto ERROR;
+	}
+
+	if(!thread_mutex_init(&(prv->job_lock))){
+		goto ERROR;
+	}
+	if(!thread_cond_init(&(prv->job_added))){
+		thread_mutex_destroy(&(prv->job_lock));
+		goto ERROR;
+	}
+	if(!thread_cond_init(&(prv->job_done))){
+		thread_cond_destroy(&(prv->job_added));
+		thread_mutex_destroy(&(prv->job_lock));
+		goto ERROR;
+	}
+
+	prv->job_head = 0;
+	prv->job_count = 0;
+	prv->job_busy = 0;
+	prv->job_error = 0;
+	prv->job_quit = 0;
+
+	for(i=0;i<count;i++){
+		if(!thread_create(prv->worker+i, decrypt_worker, prv)){
+			break;
+		}
+		prv->worker_count = i+1;
+	}
+
+	if(prv->worker_count < count){
+		stop_workers(prv);
+		return 0;
+	}
+
+	return 1;
+
+ERROR:
+	free(prv->job);
+	free(prv->worker);
+	prv->job = NULL;
+	prv->worker = NULL;
+	prv->job_max = 0;
+	return 0;
+}
+
+static void stop_workers(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int32_t i;
+
+	if(prv->job == NULL){
+		return;
+	}
+
+	if(prv->worker_count > 0){
+		thread_mutex_lock(&(prv->job_lock));
+		prv->job_quit = 1;
+		thread_cond_broadcast(&(prv->job_added));
+		thread_mutex_unlock(&(prv->job_lock));
+
+		for(i=0;i<prv->worker_count;i++){
+			thread_join(prv->worker+i);
+		}
+	}
+
+	thread_cond_destroy(&(prv->job_done));
+	thread_cond_destroy(&(prv->job_added));
+	thread_mutex_destroy(&(prv->job_lock));
+
+	free(prv->job);
+	free(prv->worker);
+	prv->job = NULL;
+	prv->worker = NULL;
+	prv->job_max = 0;
+	prv->worker_count = 0;
+}
+
+static THREAD_RESULT THREAD_CALL decrypt_worker(void *arg)
+{
+	ARIB_STD_B25_PRIVATE_DATA *prv;
+	DECRYPT_JOB job;
+
+	prv = (ARIB_STD_B25_PRIVATE_DATA *)arg;
+
+	thread_mutex_lock(&(prv->job_lock));
+	while(1){
+		while( (prv->job_count < 1) && !prv->job_quit ){
+			thread_cond_wait(&(prv->job_added), &(prv->job_lock));
+		}
+		if(prv->job_count < 1){
+			break;
+		}
+		take_decrypt_job(prv, &job);
+		thread_mutex_unlock(&(prv->job_lock));
+
+		run_decrypt_job(prv, &job);
+
+		thread_mutex_lock(&(prv->job_lock));
 	}
+	thread_mutex_unlock(&(prv->job_lock));
 
-LAST:
-	m = curr - prv->sbuf.pool;
-	n = tail - curr;
-	if( (n < 1024) || (m > (prv->sbuf.max/2) ) ){
-		p = prv->sbuf.pool;
-		if(n > 0){
-			memcpy(p, curr, n);
+	return THREAD_RETURN;
+}
+
+static void add_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, MULTI2 *m2, MULTI2_BATCH_ENTRY *ent, uint8_t **hdr, int32_t count)
+{
+	DECRYPT_JOB *job;
+
+	thread_mutex_lock(&(prv->job_lock));
+	while(prv->job_count >= prv->job_max){
+		thread_cond_wait(&(prv->job_done), &(prv->job_lock));
+	}
+
+	job = prv->job + ((prv->job_head + prv->job_count) % prv->job_max);
+	job->m2 = m2;
+	job->count = count;
+	memcpy(job->ent, ent, sizeof(MULTI2_BATCH_ENTRY)*count);
+	memcpy(job->hdr, hdr, sizeof(uint8_t *)*count);
+	prv->job_count += 1;
+
+	thread_cond_signal(&(prv->job_added));
+	thread_mutex_unlock(&(prv->job_lock));
+}
+
+/* with job_lock held */
+static void take_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPT_JOB *dst)
+{
+	DECRYPT_JOB *job;
+
+	job = prv->job + prv->job_head;
+	dst->m2 = job->m2;
+	dst->count = job->count;
+	memcpy(dst->ent, job->ent, sizeof(MULTI2_BATCH_ENTRY)*job->count);
+	memcpy(dst->hdr, job->hdr, sizeof(uint8_t *)*job->count);
+
+	prv->job_head = (prv->job_head + 1) % prv->job_max;
+	prv->job_count -= 1;
+	prv->job_busy += 1;
+
+	/* the queue has room again */
+	thread_cond_broadcast(&(prv->job_done));
+}
+
+/* without job_lock held */
+static void run_decrypt_job(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPT_JOB *job)
+{
+	int32_t i;
+	int r;
+
+	r = job->m2->decrypt_batch(job->m2, job->ent, job->count);
+	if(r >= 0){
+		for(i=0;i<job->count;i++){
+			/* transport_scrambling_control = 0 */
+			job->hdr[i][3] &= 0x3f;
 		}
-		prv->sbuf.head = p;
-		prv->sbuf.tail = p+n;
-	}else{
-		prv->sbuf.head = curr;
 	}
 
+	thread_mutex_lock(&(prv->job_lock));
+	if( (r < 0) && (prv->job_error == 0) ){
+		prv->job_error = ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+	}
+	prv->job_busy -= 1;
+	thread_cond_broadcast(&(prv->job_done));
+	thread_mutex_unlock(&(prv->job_lock));
+}
+
+/* the calling thread helps with what is queued, then waits for the rest.
+   returns the first error of the jobs since the last call */
+static int wait_decrypt_jobs(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	int r;
+	DECRYPT_JOB job;
+
+	if(prv->worker_count < 1){
+		return 0;
+	}
+
+	thread_mutex_lock(&(prv->job_lock));
+	while(prv->job_count > 0){
+		take_decrypt_job(prv, &job);
+		thread_mutex_unlock(&(prv->job_lock));
+
+		run_decrypt_job(prv, &job);
+
+		thread_mutex_lock(&(prv->job_lock));
+	}
+	while(prv->job_busy > 0){
+		thread_cond_wait(&(prv->job_done), &(prv->job_lock));
+	}
+	r = prv->job_error;
+	prv->job_error = 0;
+	thread_mutex_unlock(&(prv->job_lock));
+
 	return r;
 }
 
@@ -2441,6 +4439,8 @@ static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv)
 	int n;
 	int32_t emm_pid;
 
+	PID_SLOT *slot;
+
 	TS_SECTION sect;
 
 	r = 0;
@@ -2459,24 +4459,34 @@ static int proc_cat(ARIB_STD_B25_PRIVATE_DATA *prv)
 
 	emm_pid = find_ca_descriptor_pid(sect.data, sect.tail-4, prv->ca_system_id);
 	if( (emm_pid != 0x0000) && (emm_pid != 0x1fff) ){
-		if( (prv->map[emm_pid].target != NULL) &&
+		slot = add_pid_slot(prv, emm_pid);
+		if(slot == NULL){
+			r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+			goto LAST;
+		}
+		if( (slot->target != NULL) &&
 		    (prv->map[emm_pid].type == PID_MAP_TYPE_OTHER) ){
 			DECRYPTOR_ELEM *dec;
-			dec = (DECRYPTOR_ELEM *)(prv->map[emm_pid].target);
+			dec = (DECRYPTOR_ELEM *)(slot->target);
 			dec->ref -= 1;
 			if(dec->ref < 1){
 				remove_decryptor(prv, dec);
 			}
 		}
 		prv->emm_pid = emm_pid;
-		prv->map[emm_pid].ref = 1;
+		slot->ref = 1;
+		slot->target = NULL;
 		prv->map[emm_pid].type = PID_MAP_TYPE_EMM;
-		prv->map[emm_pid].target = NULL;
 	}
 
-	prv->map[0x0001].ref = 1;
+	slot = add_pid_slot(prv, 0x0001);
+	if(slot == NULL){
+		r = ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		goto LAST;
+	}
+	slot->ref = 1;
+	slot->target = NULL;
 	prv->map[0x0001].type = PID_MAP_TYPE_CAT;
-	prv->map[0x0001].target = NULL;
 
 LAST:
 	if(sect.raw != NULL){
@@ -2502,6 +4512,12 @@ static int proc_emm(ARIB_STD_B25_PRIVATE_DATA *prv)
 	TS_SECTION sect;
 	EMM_FIXED_PART emm_hdr;
 
+	/* the card is one thread's at a time */
+	r = poll_ecm_jobs(prv, 0);
+	if(r < 0){
+		return r;
+	}
+
 	r = 0;
 	memset(&sect, 0, sizeof(sect));
 
@@ -2578,6 +4594,7 @@ static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 {
 	int32_t pid;
 	TS_STREAM_ELEM *strm;
+	PID_SLOT *slot;
 
 	pid = pgrm->pmt_pid;
 
@@ -2598,38 +4615,82 @@ static void release_program(ARIB_STD_B25_PRIVATE_DATA *prv, TS_PROGRAM *pgrm)
 		put_stream_list_tail(&(prv->strm_pool), strm);
 	}
 
+	slot = find_pid_slot(prv, pid);
 	prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
-	prv->map[pid].ref = 0;
-	prv->map[pid].target = NULL;
+	slot->ref = 0;
+	slot->target = NULL;
 }
 
 static void unref_stream(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
 {
 	DECRYPTOR_ELEM *dec;
+	PID_SLOT *slot;
 
-	prv->map[pid].ref -= 1;
-	if( prv->map[pid].ref < 1 ){
-		if( (prv->map[pid].target != NULL) &&
+	slot = find_pid_slot(prv, pid);
+	if( slot->ref < 2 ){
+		if( (slot->target != NULL) &&
 		    (prv->map[pid].type == PID_MAP_TYPE_OTHER) ){
-			dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+			dec = (DECRYPTOR_ELEM *)(slot->target);
 			dec->ref -= 1;
 			if(dec->ref < 1){
 				remove_decryptor(prv, dec);
 			}
 		}
 		prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
-		prv->map[pid].ref = 0;
-		prv->map[pid].target = NULL;
+		slot->ref = 0;
+		slot->target = NULL;
+	}else{
+		slot->ref -= 1;
+	}
+}
+
+static void clear_pid_map(ARIB_STD_B25_PRIVATE_DATA *prv)
+{
+	memset(prv->map, 0, sizeof(prv->map));
+	memset(prv->slot, 0, sizeof(PID_SLOT));
+	prv->slot_count = 1;
+}
+
+static PID_SLOT *find_pid_slot(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	return prv->slot + prv->map[pid].slot;
+}
+
+static PID_SLOT *add_pid_slot(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
+{
+	PID_SLOT *r;
+
+	if(prv->map[pid].slot != 0){
+		return prv->slot + prv->map[pid].slot;
+	}
+
+	r = (PID_SLOT *)reserve_array(prv->slot, &(prv->slot_max), prv->slot_count+1, sizeof(PID_SLOT));
+	if(r == NULL){
+		return NULL;
 	}
+	prv->slot = r;
+
+	r += prv->slot_count;
+	memset(r, 0, sizeof(PID_SLOT));
+	prv->map[pid].slot = (uint16_t)prv->slot_count;
+	prv->slot_count += 1;
+
+	return r;
 }
 
 static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid)
 {
 	DECRYPTOR_ELEM *r;
+	PID_SLOT *slot;
+
+	slot = add_pid_slot(prv, pid);
+	if(slot == NULL){
+		return NULL;
+	}
 
 	r = NULL;
 	if(prv->map[pid].type == PID_MAP_TYPE_ECM){
-		r = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+		r = (DECRYPTOR_ELEM *)(slot->target);
 		if(r != NULL){
 			return r;
 		}
@@ -2660,9 +4721,9 @@ static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid
 	}
 
 	if( (prv->map[pid].type == PID_MAP_TYPE_OTHER) &&
-	    (prv->map[pid].target != NULL) ){
+	    (slot->target != NULL) ){
 		DECRYPTOR_ELEM *dec;
-		dec = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+		dec = (DECRYPTOR_ELEM *)(slot->target);
 		dec->ref -= 1;
 		if(dec->ref < 1){
 			remove_decryptor(prv, dec);
@@ -2670,23 +4731,28 @@ static DECRYPTOR_ELEM *set_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid
 	}
 
 	prv->map[pid].type = PID_MAP_TYPE_ECM;
-	prv->map[pid].target = r;
+	slot->target = r;
 
 	return r;
 }
 
 static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec)
 {
+	int32_t i;
 	int32_t pid;
 
 	DECRYPTOR_ELEM *prev;
 	DECRYPTOR_ELEM *next;
 
+	PID_SLOT *slot;
+	ECM_JOB *job;
+
 	pid = dec->ecm_pid;
+	slot = find_pid_slot(prv, pid);
 	if( (prv->map[pid].type == PID_MAP_TYPE_ECM) &&
-	    (prv->map[pid].target == ((void *)dec)) ){
+	    (slot->target == ((void *)dec)) ){
 		prv->map[pid].type = PID_MAP_TYPE_UNKNOWN;
-		prv->map[pid].target = NULL;
+		slot->target = NULL;
 	}
 
 	prev = (DECRYPTOR_ELEM *)(dec->prev);
@@ -2703,6 +4769,18 @@ static void remove_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, DECRYPTOR_ELEM *dec
 	}
 	prv->decrypt.count -= 1;
 
+	if(prv->ecm_job != NULL){
+		/* a result on its way is dropped */
+		thread_mutex_lock(&(prv->ecm_lock));
+		for(i=0;i<prv->ecm_count;i++){
+			job = prv->ecm_job + ((prv->ecm_head + i) % ECM_JOB_MAX);
+			if(job->dec == dec){
+				job->dec = NULL;
+			}
+		}
+		thread_mutex_unlock(&(prv->ecm_lock));
+	}
+
 	if(dec->ecm != NULL){
 		dec->ecm->release(dec->ecm);
 		dec->ecm = NULL;
@@ -2730,8 +4808,12 @@ static DECRYPTOR_ELEM *select_active_decryptor(DECRYPTOR_ELEM *a, DECRYPTOR_ELEM
 static void bind_stream_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, DECRYPTOR_ELEM *dec)
 {
 	DECRYPTOR_ELEM *old;
+	PID_SLOT *slot;
+
+	/* proc_pmt() has made the slot */
+	slot = find_pid_slot(prv, pid);
 
-	old = (DECRYPTOR_ELEM *)(prv->map[pid].target);
+	old = (DECRYPTOR_ELEM *)(slot->target);
 	if(old == dec){
 		/* already binded - do nothing */
 		return;
@@ -2742,11 +4824,11 @@ static void bind_stream_decryptor(ARIB_STD_B25_PRIVATE_DATA *prv, int32_t pid, D
 		if(old->ref == 0){
 			remove_decryptor(prv, old);
 		}
-		prv->map[pid].target = NULL;
+		slot->target = NULL;
 	}
 
 	if(dec != NULL){
-		prv->map[pid].target = dec;
+		slot->target = dec;
 		dec->ref += 1;
 	}
 }
@@ -2869,6 +4951,11 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 		n += n;
 	}
 
+#if defined(ENABLE_RING_BUFFER)
+	if(buf->ring != RING_BUFFER_OFF){
+		p = map_ring(&n, buf->ring);
+	}else
+#endif
 #ifdef ENABLE_MULTI2_SIMD
 	p = (uint8_t *)mem_aligned_alloc(n);
 #else
@@ -2884,12 +4971,7 @@ static int reserve_work_buffer(TS_WORK_BUFFER *buf, intptr_t size)
 		if(m > 0){
 			memcpy(p, buf->head, m);
 		}
-#ifdef ENABLE_MULTI2_SIMD
-		mem_aligned_free(buf->pool);
-#else
-		free(buf->pool);
-#endif
-		buf->pool = NULL;
+		release_work_buffer(buf);
 	}
 
 	buf->pool = p;
@@ -2909,7 +4991,8 @@ static int append_work_buffer(TS_WORK_BUFFER *buf, uint8_t *data, int32_t size)
 		return 1;
 	}
 
-	m = buf->tail - buf->pool;
+	/* a ring has room for max bytes from wherever head is */
+	m = buf->tail - ((buf->ring != RING_BUFFER_OFF) ? buf->head : buf->pool);
 
 	if( (m+size) > buf->max ){
 		if(!reserve_work_buffer(buf, m+size)){
@@ -2917,9 +5000,109 @@ static int append_work_buffer(TS_WORK_BUFFER *buf, uint8_t *data, int32_t size)
 		}
 	}
 
-	memcpy(buf->tail, data, size);
+	/* in place the data is already there */
+	if(buf->tail != data){
+		memcpy(buf->tail, data, size);
+	}
+	buf->tail += size;
+
+	return 1;
+}
+
+/* appends a size byte packet whose payload (payload bytes at offset) is
+   decrypted on the way, instead of decrypting it in the source buffer
+   and copying it afterwards */
+static int append_decrypted_packet(TS_WORK_BUFFER *buf, MULTI2 *m2, int32_t crypt, uint8_t *data, int32_t offset, int32_t payload, int32_t size)
+{
+	int r;
+	intptr_t m;
+	uint8_t *p;
+
+	m = buf->tail - ((buf->ring != RING_BUFFER_OFF) ? buf->head : buf->pool);
+
+	if( (m+size) > buf->max ){
+		if(!reserve_work_buffer(buf, m+size)){
+			return ARIB_STD_B25_ERROR_NO_ENOUGH_MEMORY;
+		}
+	}
+
+	p = buf->tail;
+
+	r = m2->decrypt_to(m2, crypt, data+offset, p+offset, payload);
+	if(r < 0){
+		return ARIB_STD_B25_ERROR_DECRYPT_FAILURE;
+	}
+
+	if(p != data){
+		memcpy(p, data, offset);
+		memcpy(p+offset+payload, data+offset+payload, size-offset-payload);
+	}
+
+	/* transport_scrambling_control = 0 */
+	p[3] &= 0x3f;
+
 	buf->tail += size;
 
+	return 0;
+}
+
+/* drops the data up to curr */
+static void consume_work_buffer(TS_WORK_BUFFER *buf, uint8_t *curr)
+{
+	intptr_t m,n;
+
+	n = buf->tail - curr;
+
+	if(buf->ring != RING_BUFFER_OFF){
+		/* past the first view is the same memory in the second one,
+		   nothing has to move */
+		if(curr >= (buf->pool + buf->max)){
+			curr -= buf->max;
+		}
+		buf->head = curr;
+		buf->tail = curr+n;
+		return;
+	}
+
+	m = curr - buf->pool;
+	if( (n < 1024) || (m > (buf->max/2) ) ){
+		if(n > 0){
+			memmove(buf->pool, curr, n);
+		}
+		buf->head = buf->pool;
+		buf->tail = buf->pool+n;
+	}else{
+		buf->head = curr;
+	}
+}
+
+/* moves the data to memory of the other kind */
+static int convert_work_buffer(TS_WORK_BUFFER *buf, int32_t ring)
+{
+	intptr_t m;
+	TS_WORK_BUFFER tmp;
+
+	if(buf->ring == ring){
+		return 1;
+	}
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.ring = ring;
+
+	if(buf->pool != NULL){
+		if(!reserve_work_buffer(&tmp, buf->max)){
+			return 0;
+		}
+		m = buf->tail - buf->head;
+		if(m > 0){
+			memcpy(tmp.head, buf->head, m);
+		}
+		tmp.tail = tmp.head + m;
+	}
+
+	release_work_buffer(buf);
+	*buf = tmp;
+
 	return 1;
 }
 
@@ -2929,9 +5112,15 @@ static void reset_work_buffer(TS_WORK_BUFFER *buf)
 	buf->tail = buf->pool;
 }
 
+/* frees the memory, the ring mode stays */
 static void release_work_buffer(TS_WORK_BUFFER *buf)
 {
 	if(buf->pool != NULL){
+#if defined(ENABLE_RING_BUFFER)
+		if(buf->ring != RING_BUFFER_OFF){
+			munmap(buf->pool, (size_t)buf->max * 2);
+		}else
+#endif
 #ifdef ENABLE_MULTI2_SIMD
 		mem_aligned_free(buf->pool);
 #else
@@ -2944,6 +5133,67 @@ static void release_work_buffer(TS_WORK_BUFFER *buf)
 	buf->max = 0;
 }
 
+#if defined(ENABLE_RING_BUFFER)
+static uint8_t *map_ring(int *size, int32_t ring)
+{
+	uint8_t *p;
+
+	/* huge pages only where some are reserved, small ones otherwise */
+	if(ring == RING_BUFFER_HUGE){
+		p = map_ring_pages(size, RING_HUGE_PAGE_SIZE, MFD_HUGETLB);
+		if(p != NULL){
+			return p;
+		}
+	}
+
+	return map_ring_pages(size, (intptr_t)sysconf(_SC_PAGESIZE), 0);
+}
+
+static uint8_t *map_ring_pages(int *size, intptr_t page, unsigned int flags)
+{
+	int fd;
+	intptr_t n;
+	uint8_t *area;
+	uint8_t *base;
+
+	n = (*size + page - 1) & ~(page - 1);
+
+	fd = (int)syscall(SYS_memfd_create, "aribb25", MFD_CLOEXEC | flags);
+	if(fd < 0){
+		return NULL;
+	}
+	if(ftruncate(fd, n) != 0){
+		close(fd);
+		return NULL;
+	}
+
+	/* reserve 2n page aligned addresses, then map the file over both
+	   halves */
+	area = (uint8_t *)mmap(NULL, 2*n + page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(area == (uint8_t *)MAP_FAILED){
+		close(fd);
+		return NULL;
+	}
+	base = (uint8_t *)(((uintptr_t)area + page - 1) & ~(uintptr_t)(page - 1));
+	if(base > area){
+		munmap(area, base - area);
+	}
+	munmap(base + 2*n, (area + 2*n + page) - (base + 2*n));
+
+	if( (mmap(base, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+	    (mmap(base+n, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ){
+		munmap(base, 2*n);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	*size = (int)n;
+
+	return base;
+}
+#endif
+
 static void extract_ts_header(TS_HEADER *dst, uint8_t *src)
 {
 	dst->sync                         =  src[0];
@@ -2956,6 +5206,35 @@ static void extract_ts_header(TS_HEADER *dst, uint8_t *src)
 	dst->continuity_counter           =  src[3]       & 0x0f;
 }
 
+static int32_t classify_packets(TS_PACKET_DESC *dst, uint8_t *head, uint8_t *tail, int32_t unit_size)
+{
+	int32_t i,n;
+	uint32_t h;
+	uint8_t *p;
+
+	/* packets that have their successor's sync byte in the buffer */
+	n = (int32_t)((tail - head - 1) / unit_size);
+	if(n > TS_PACKET_WINDOW){
+		n = TS_PACKET_WINDOW;
+	}
+
+	/* straight-line and independent per packet, so the compiler can
+	   unroll or vectorize it - the header is one 32-bit load */
+	p = head;
+	for(i=0;i<n;i++){
+		h = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+		dst[i].pid   = (uint16_t)((h >> 8) & 0x1fff);
+		dst[i].crypt = (uint8_t)((h >> 6) & 0x03);
+		dst[i].flags = (uint8_t)( ((h >> 4) & 0x03) |
+		                          ((h >> 21) & TS_PACKET_FLAG_ERROR) |
+		                          ((((h >> 8) & 0x1fff) == 0x1fff) ? TS_PACKET_FLAG_NULL : 0) |
+		                          (((p[0] == 0x47) && (p[unit_size] == 0x47)) ? TS_PACKET_FLAG_SYNC : 0) );
+		p += unit_size;
+	}
+
+	return n;
+}
+
 static void extract_emm_fixed_part(EMM_FIXED_PART *dst, uint8_t *src)
 {
 	int i;
@@ -2975,10 +5254,24 @@ static void extract_emm_fixed_part(EMM_FIXED_PART *dst, uint8_t *src)
 static uint8_t *resync(uint8_t *head, uint8_t *tail, int32_t unit_size)
 {
 	int i;
+	uint32_t mask;
 	unsigned char *buf;
 
 	buf = head;
 	tail -= unit_size * 8;
+
+	/* 32 positions at a time, keeping those with 0x47 at all 8 strides */
+	while( (buf+31) <= tail ){
+		mask = sync_byte_mask(buf);
+		for(i=1;(i<8)&&(mask!=0);i++){
+			mask &= sync_byte_mask(buf+unit_size*i);
+		}
+		if(mask != 0){
+			return buf + lowest_bit(mask);
+		}
+		buf += 32;
+	}
+
 	while( buf <= tail ){
 		if(buf[0] == 0x47){
 			for(i=1;i<8;i++){
@@ -3000,30 +5293,122 @@ static uint8_t *resync_force(uint8_t *head, uint8_t *tail, int32_t unit_size)
 {
 	int i;
 	intptr_t n;
+	uint32_t mask;
 	unsigned char *buf;
 
 	buf = head;
-	while( buf <= (tail-188) ){
-		if(buf[0] == 0x47){
-			n = (tail - buf) / unit_size;
-			if(n == 0){
-				return buf;
-			}
-			for(i=1;i<n;i++){
-				if(buf[unit_size*i] != 0x47){
-					break;
-				}
-			}
-			if(i == n){
-				return buf;
+
+	/* candidates are filtered 32 at a time on the strides every one of
+	   them has to match (at most 8), then checked to the tail one by one */
+	while( (buf+31) <= (tail-188) ){
+		mask = sync_byte_mask(buf);
+		n = (tail - (buf+31)) / unit_size;
+		for(i=1;(i<n)&&(i<8)&&(mask!=0);i++){
+			mask &= sync_byte_mask(buf+unit_size*i);
+		}
+		while(mask != 0){
+			i = lowest_bit(mask);
+			mask &= mask - 1;
+			if(check_sync_force(buf+i, tail, unit_size)){
+				return buf+i;
 			}
 		}
+		buf += 32;
+	}
+
+	while( buf <= (tail-188) ){
+		if( (buf[0] == 0x47) && check_sync_force(buf, tail, unit_size) ){
+			return buf;
+		}
 		buf += 1;
 	}
 
 	return NULL;
 }
 
+static int check_sync_force(uint8_t *buf, uint8_t *tail, int32_t unit_size)
+{
+	int i;
+	intptr_t n;
+
+	n = (tail - buf) / unit_size;
+	for(i=1;i<n;i++){
+		if(buf[unit_size*i] != 0x47){
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint8_t *resync_resume(uint8_t *head, uint8_t *tail, int32_t unit_size)
+{
+	uint8_t *p;
+
+	/* resync() has tried every position that has its 8 strides in the
+	   buffer, so the next search starts after them - this keeps a burst
+	   of garbage from being scanned (and held in sbuf) over and over.
+	   the unit-188 bytes ahead of a sync byte stay for the time stamp,
+	   and the position is not a 0x47 so that the callers' quick check
+	   of 2 sync bytes can't take it for a packet */
+	p = tail - unit_size*8 + 1 - (unit_size-188);
+	if(p <= head){
+		return head;
+	}
+	while( (p > head) && (p[0] == 0x47) ){
+		p -= 1;
+	}
+
+	return p;
+}
+
+static uint32_t sync_byte_mask(uint8_t *p)
+{
+	/* bit i is set when p[i] is 0x47, for i in 0 to 31 */
+#if defined(SYNC_SCAN_AVX2)
+	__m256i v;
+
+	v = _mm256_loadu_si256((const __m256i *)p);
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x47)));
+#elif defined(SYNC_SCAN_SSE2)
+	__m128i s,lo,hi;
+
+	s = _mm_set1_epi8(0x47);
+	lo = _mm_loadu_si128((const __m128i *)p);
+	hi = _mm_loadu_si128((const __m128i *)(p+16));
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lo, s)) |
+	       ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(hi, s)) << 16);
+#else
+	int i;
+	uint32_t mask;
+
+	mask = 0;
+	for(i=0;i<32;i++){
+		mask |= (uint32_t)(p[i] == 0x47) << i;
+	}
+	return mask;
+#endif
+}
+
+static int32_t lowest_bit(uint32_t mask)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+
+	_BitScanForward(&i, mask);
+	return (int32_t)i;
+#elif defined(__GNUC__)
+	return __builtin_ctz(mask);
+#else
+	int32_t i;
+
+	for(i=0;(mask & 1) == 0;i++){
+		mask >>= 1;
+	}
+	return i;
+#endif
+}
+
 void fill_random_bytes(uint8_t *data, size_t size)
 {
 	uint8_t mask = 0xFF;
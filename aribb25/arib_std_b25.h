@@ -3,6 +3,7 @@
 
 #include "portable.h"
 #include "b_cas_card.h"
+#include "ecm_cache.h"
 
 typedef struct {
 	uint8_t *data;
@@ -50,6 +51,57 @@ typedef struct {
 
 	int (*withdraw)(void *std_b25, ARIB_STD_B25_BUFFER *buf);
 
+	/* on != 0: once PAT/PMT/ECM are known, put() descrambles inside
+	   buf->data and get() returns ranges of it one by one, so keep the
+	   buffer as is and call get() until it returns size 0 before the
+	   next put(). a failed put() narrows buf to the input it did not
+	   process */
+	int (* set_in_place)(void *std_b25, int32_t on);
+
+	/* like get(), but hands out all the output at once as segments.
+	   returns the segment count, *iov is valid until the next put() */
+	int (* get_iov)(void *std_b25, ARIB_STD_B25_BUFFER **iov);
+
+	/* put() of count segments in one pass. in in-place mode a packet
+	   across two segments is the only thing copied, the segments must
+	   stay as they are until the output is taken, and on failure the
+	   segments done get size 0 and the failing one is narrowed */
+	int (* put_iov)(void *std_b25, ARIB_STD_B25_BUFFER *iov, int32_t count);
+
+	/* count > 0 decrypts on that many threads besides the caller's,
+	   with the output in input order as always. 0 (the default) turns
+	   them off */
+	int (* set_worker_count)(void *std_b25, int32_t count);
+
+	/* 1 keeps the work buffers in rings mapped twice in a row, so the
+	   unprocessed input never moves back to the start of its buffer,
+	   2 also asks for huge pages (used where the system has some
+	   reserved). 0 (the default) is plain heap memory. rings are Linux
+	   only, elsewhere 1 and 2 are ARIB_STD_B25_ERROR_INVALID_PARAM */
+	int (* set_ring_buffer)(void *std_b25, int32_t mode);
+
+	/* max_bytes > 0 starts without waiting for PAT, PMT and ECM: the
+	   scrambled packets are held until their key is there, along with
+	   the packets of the same PID behind them, the rest go out at once.
+	   the held ones go out as they are once more than max_bytes are
+	   held or the oldest is max_msec old (0 - no time limit). put()
+	   returns no ARIB_STD_B25_WARN_* codes then. 0 (the default) is
+	   the buffered start */
+	int (* set_low_latency)(void *std_b25, int32_t max_bytes, int32_t max_msec);
+
+	/* max_hold > 0 sends the ECMs of a program that already has a key to
+	   the card on a thread of its own. the packets go on with the key
+	   there, those of the other parity wait until the card answers, up
+	   to max_hold bytes, past that put() waits for the card. 0 (the
+	   default) asks the card in line with the packets */
+	int (* set_async_ecm)(void *std_b25, int32_t max_hold);
+
+	/* answers to ECMs are looked up in cache before the card is asked,
+	   and the card's answers go there. the cache may be shared with
+	   other instances, each holds a reference. NULL (the default) - no
+	   cache */
+	int (* set_ecm_cache)(void *std_b25, ECM_CACHE *cache);
+
 } ARIB_STD_B25;
 
 #define ARIB_STD_B25_TS_PROBING_MIN_DATA (320 * 9 - 1)
@@ -82,13 +82,29 @@ static const uint8_t EMM_RECEIVE_CMD_HEADER[] = {
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
 static void release_b_cas_card(void *bcas);
 static int init_b_cas_card(void *bcas);
-static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name);
+static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name, int index);
+static void load_card_reader_name(TCHAR *card_reader_name);
 static int get_init_status_b_cas_card(void *bcas, B_CAS_INIT_STATUS *stat);
 static int get_id_b_cas_card(void *bcas, B_CAS_ID *dst);
 static int get_pwr_on_ctrl_b_cas_card(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
 static int proc_ecm_b_cas_card(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
 static int proc_emm_b_cas_card(void *bcas, uint8_t *src, int len);
 
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_PRIVATE_DATA *private_data(void *bcas);
+static void teardown(B_CAS_CARD_PRIVATE_DATA *prv);
+static int change_id_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
+static int change_pwc_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
+static int connect_card(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR reader_name);
+static void extract_power_on_ctrl_response(B_CAS_PWR_ON_CTRL *dst, uint8_t *src);
+static void extract_mjd(int *yy, int *mm, int *dd, int mjd);
+static int setup_ecm_receive_command(uint8_t *dst, uint8_t *src, int len);
+static int setup_emm_receive_command(uint8_t *dst, uint8_t *src, int len);
+static int32_t load_be_uint16(uint8_t *p);
+static int64_t load_be_uint48(uint8_t *p);
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -130,21 +146,44 @@ int override_card_reader_name_pattern(const char * name) {
 	}
 }
 
+int init_b_cas_card_by_index(B_CAS_CARD *bcas, int index)
+{
+	TCHAR card_reader_name[1024];
+
+	if(index < 0){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	load_card_reader_name(card_reader_name);
+
+	return init_b_cas_card_with_name(bcas, card_reader_name, index);
+}
+
+int get_b_cas_card_reader_name(B_CAS_CARD *bcas, LPTSTR dst, int size)
+{
+	int n;
+
+	B_CAS_CARD_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->card == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	n = (int)_tcslen(prv->reader);
+	if(n >= size){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	memcpy(dst, prv->reader, sizeof(TCHAR)*(n+1));
+
+	return n;
+}
 
-/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
- function prototypes (private method)
- ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-static B_CAS_CARD_PRIVATE_DATA *private_data(void *bcas);
-static void teardown(B_CAS_CARD_PRIVATE_DATA *prv);
-static int change_id_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
-static int change_pwc_max(B_CAS_CARD_PRIVATE_DATA *prv, int max);
-static int connect_card(B_CAS_CARD_PRIVATE_DATA *prv, LPCTSTR reader_name);
-static void extract_power_on_ctrl_response(B_CAS_PWR_ON_CTRL *dst, uint8_t *src);
-static void extract_mjd(int *yy, int *mm, int *dd, int mjd);
-static int setup_ecm_receive_command(uint8_t *dst, uint8_t *src, int len);
-static int setup_emm_receive_command(uint8_t *dst, uint8_t *src, int len);
-static int32_t load_be_uint16(uint8_t *p);
-static int64_t load_be_uint48(uint8_t *p);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  interface method implementation
@@ -165,6 +204,22 @@ static void release_b_cas_card(void *bcas)
 
 static int init_b_cas_card(void *bcas)
 {
+	TCHAR card_reader_name[1024];
+
+	load_card_reader_name(card_reader_name);
+
+	return init_b_cas_card_with_name(bcas, card_reader_name, -1);
+}
+
+static void load_card_reader_name(TCHAR *card_reader_name)
+{
+	card_reader_name[0] = 0;
+
+	if (_tcslen(pattern) > 0 && _tcslen(pattern) < 1024) {
+		strcpy(card_reader_name, pattern);
+		return;
+	}
+
 #if defined(_WIN32)
 	// この dll/exe と拡張子なしファイル名が同じ ini ファイルのパスを取得
 	// ini ファイルは以下のような構造
@@ -178,37 +233,22 @@ static int init_b_cas_card(void *bcas)
 	OutputDebugString(ini_file_path);
 
 	// card_reader_name に GetPrivateProfileString() で取得したカードリーダー名を入れる
-	// ini ファイルや値がないなどカードリーダー名を取得できなかった場合は、card_reader_name はNULLになる
-	TCHAR *card_reader_name;
-	card_reader_name = (TCHAR *)malloc(1024);
+	// ini ファイルや値がないなどカードリーダー名を取得できなかった場合は、card_reader_name は空文字列になる
 	GetPrivateProfileString(_T("CardReader"), _T("Name"), _T(""), card_reader_name, 1024, ini_file_path);
 
-	if(card_reader_name == NULL){
+	if(_tcslen(card_reader_name) == 0){
 		OutputDebugString(TEXT("libaribb25: no card reader name specified in ini file."));
 	} else {
 		OutputDebugString(TEXT("libaribb25: specified card reader name:"));
 		OutputDebugString(card_reader_name);
 	}
 #endif
-
-	if (pattern != NULL && _tcslen(pattern) > 0 && _tcslen(pattern) < 1024) {
-		return init_b_cas_card_with_name(bcas, pattern);
-	}
-#if defined(_WIN32)
-	else if (card_reader_name != NULL && _tcslen(card_reader_name) > 0 && _tcslen(card_reader_name) < 1024) {
-		int code = init_b_cas_card_with_name(bcas, card_reader_name);
-		free(card_reader_name);
-		return code;
-	}
-#endif
-	else {
-		return init_b_cas_card_with_name(bcas, "");
-	}
 }
 
-static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name)
+static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name, int index)
 {
 	int m;
+	int reached;
 	long ret;
 	unsigned long len;
 
@@ -251,6 +291,7 @@ static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name)
 		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
 	}
 
+	reached = 0;
 	while( prv->reader[0] != 0 ){
 
 #if defined(_WIN32)
@@ -263,7 +304,13 @@ static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name)
 
 		// 取得したカードリーダー名のカードリーダーなら接続を試みる
 		// もしカードリーダー名が空文字列ならすべてのカードリーダーに接続を試み、最初に見つかったカードリーダーに接続する
-		if(_tcscmp(card_reader_name, prv->reader) == 0 || _tcscmp(card_reader_name, _T("")) == 0){
+		// index が 0 以上なら該当するカードリーダーのうち index 番目のものにだけ接続を試みる
+		if(_tcscmp(card_reader_name, prv->reader) != 0 && _tcscmp(card_reader_name, _T("")) != 0){
+			/* not the configured reader */
+		}else if(index > 0){
+			index -= 1;
+		}else{
+			reached = 1;
 			if(connect_card(prv, prv->reader)){
 #if defined(_WIN32)
 				OutputDebugString(TEXT("libaribb25: connected card reader name:"));
@@ -281,12 +328,20 @@ static int init_b_cas_card_with_name(void *bcas, const char * card_reader_name)
 				fprintf(stderr, "libaribb25: failed to connect card reader name:\n");
 				fprintf(stderr, "%.1024s\n", prv->reader);
 #endif
+				if(index == 0){
+					break;
+				}
 			}
 		}
 
 		prv->reader += (_tcslen(prv->reader) + 1);
 	}
 
+	if( (index >= 0) && !reached ){
+		/* fewer readers than that */
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
 	if(prv->card == 0){
 #if defined(_WIN32)
 		OutputDebugString(TEXT("libaribb25: all the attempts failed."));
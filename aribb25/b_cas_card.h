@@ -3,6 +3,10 @@
 
 #include "portable.h"
 
+#if defined(_WIN32)
+#  include <tchar.h>
+#endif
+
 typedef struct {
 	uint8_t  system_key[32];
 	uint8_t  init_cbc[8];
@@ -69,6 +73,37 @@ extern "C" {
 extern B_CAS_CARD *create_b_cas_card(void);
 extern int override_card_reader_name_pattern(const char * name);
 
+/* init() on the index-th of the readers init() would try only, index from
+   0, so a configured reader name still applies. returns
+   B_CAS_CARD_ERROR_NO_SMART_CARD_READER past the last of them */
+extern int init_b_cas_card_by_index(B_CAS_CARD *bcas, int index);
+
+/* the name of the reader a card made by create_b_cas_card() is connected
+   to, copied into dst with its terminator. size and the length returned
+   count TCHARs, wchar_t in a UNICODE build on Windows */
+#if defined(_WIN32)
+extern int get_b_cas_card_reader_name(B_CAS_CARD *bcas, _TCHAR *dst, int size);
+#else
+extern int get_b_cas_card_reader_name(B_CAS_CARD *bcas, char *dst, int size);
+#endif
+
+/* serializes the calls from several threads (decoders) to card on one
+   thread of its own, ECM before EMM, an ECM already waiting is sent once
+   for all. card is released along with the broker */
+extern B_CAS_CARD *create_b_cas_card_broker(B_CAS_CARD *card);
+
+/* one card per reader, every reader whose card is of the same system as
+   the first one. proc_ecm goes to the card with the fewest calls on it
+   and to another one if that card fails, a failed card is left out
+   until the next init(). may be called from several threads */
+extern B_CAS_CARD *create_b_cas_card_pool(void);
+
+/* watches the readers with SCardGetStatusChange() once init() has
+   succeeded. a card removed, reset or failing a transmit is connected
+   again in the background, an ECM that failed meanwhile waits up to a
+   second for it and is sent again. card is released along with it */
+extern B_CAS_CARD *create_b_cas_card_monitor(B_CAS_CARD *card);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,442 @@
+#include "b_cas_card.h"
+#include "b_cas_card_error_code.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "portable_thread.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+enum BROKER_REQUEST_TYPE {
+	BROKER_REQUEST_INIT = 0,
+	BROKER_REQUEST_INIT_STATUS,
+	BROKER_REQUEST_ID,
+	BROKER_REQUEST_PWR_ON_CTRL,
+	BROKER_REQUEST_ECM,
+	BROKER_REQUEST_EMM,
+};
+
+/* queues by priority, the first one not empty is served */
+enum BROKER_PRIORITY {
+	BROKER_PRIORITY_CONTROL = 0,
+	BROKER_PRIORITY_ECM,
+	BROKER_PRIORITY_EMM,
+	BROKER_PRIORITY_COUNT,
+};
+
+/* lives on the stack of the thread that waits for it */
+typedef struct BROKER_REQUEST_TAG {
+	struct BROKER_REQUEST_TAG *next;
+	struct BROKER_REQUEST_TAG *same;   /* identical ECMs answered along */
+	int32_t                    type;
+	uint8_t                   *src;
+	int                        len;
+	void                      *dst;
+	int                        r;
+	int32_t                    done;
+} BROKER_REQUEST;
+
+typedef struct {
+	BROKER_REQUEST            *head;
+	BROKER_REQUEST            *tail;
+} BROKER_QUEUE;
+
+typedef struct {
+
+	B_CAS_CARD                *card;
+
+	THREAD                     thread;
+	THREAD_MUTEX               lock;
+	THREAD_COND                added;
+	THREAD_COND                done;
+	int32_t                    quit;
+
+	BROKER_QUEUE               queue[BROKER_PRIORITY_COUNT];
+	BROKER_REQUEST            *busy;   /* on the card now */
+
+} B_CAS_CARD_BROKER_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_broker(void *bcas);
+static int init_b_cas_card_broker(void *bcas);
+static int get_init_status_b_cas_card_broker(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_b_cas_card_broker(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_b_cas_card_broker(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_b_cas_card_broker(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_b_cas_card_broker(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_BROKER_PRIVATE_DATA *private_data(void *bcas);
+static int call_card(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, int32_t type, void *dst, uint8_t *src, int len);
+static BROKER_REQUEST *find_same_ecm(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, uint8_t *src, int len);
+static void put_request(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, BROKER_REQUEST *req);
+static BROKER_REQUEST *take_request(B_CAS_CARD_BROKER_PRIVATE_DATA *prv);
+static void run_request(B_CAS_CARD *card, BROKER_REQUEST *req);
+static THREAD_RESULT THREAD_CALL broker_thread(void *arg);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+B_CAS_CARD *create_b_cas_card_broker(B_CAS_CARD *card)
+{
+	int n;
+
+	B_CAS_CARD *r;
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	if(card == NULL){
+		return NULL;
+	}
+
+	n = sizeof(B_CAS_CARD) + sizeof(B_CAS_CARD_BROKER_PRIVATE_DATA);
+	prv = (B_CAS_CARD_BROKER_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	prv->card = card;
+
+	if(!thread_mutex_init(&(prv->lock))){
+		free(prv);
+		return NULL;
+	}
+	if(!thread_cond_init(&(prv->added))){
+		thread_mutex_destroy(&(prv->lock));
+		free(prv);
+		return NULL;
+	}
+	if(!thread_cond_init(&(prv->done))){
+		thread_cond_destroy(&(prv->added));
+		thread_mutex_destroy(&(prv->lock));
+		free(prv);
+		return NULL;
+	}
+	if(!thread_create(&(prv->thread), broker_thread, prv)){
+		thread_cond_destroy(&(prv->done));
+		thread_cond_destroy(&(prv->added));
+		thread_mutex_destroy(&(prv->lock));
+		free(prv);
+		return NULL;
+	}
+
+	r = (B_CAS_CARD *)(prv+1);
+
+	r->private_data = prv;
+
+	r->release = release_b_cas_card_broker;
+	r->init = init_b_cas_card_broker;
+	r->get_init_status = get_init_status_b_cas_card_broker;
+	r->get_id = get_id_b_cas_card_broker;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_b_cas_card_broker;
+	r->proc_ecm = proc_ecm_b_cas_card_broker;
+	r->proc_emm = proc_emm_b_cas_card_broker;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_broker(void *bcas)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	/* no caller may be left waiting by now */
+	thread_mutex_lock(&(prv->lock));
+	prv->quit = 1;
+	thread_cond_broadcast(&(prv->added));
+	thread_mutex_unlock(&(prv->lock));
+	thread_join(&(prv->thread));
+
+	thread_cond_destroy(&(prv->done));
+	thread_cond_destroy(&(prv->added));
+	thread_mutex_destroy(&(prv->lock));
+
+	prv->card->release(prv->card);
+
+	memset(bcas, 0, sizeof(B_CAS_CARD));
+	free(prv);
+}
+
+static int init_b_cas_card_broker(void *bcas)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_INIT, NULL, NULL, 0);
+}
+
+static int get_init_status_b_cas_card_broker(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (stat == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_INIT_STATUS, stat, NULL, 0);
+}
+
+static int get_id_b_cas_card_broker(void *bcas, B_CAS_ID *dst)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_ID, dst, NULL, 0);
+}
+
+static int get_pwr_on_ctrl_b_cas_card_broker(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_PWR_ON_CTRL, dst, NULL, 0);
+}
+
+static int proc_ecm_b_cas_card_broker(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(dst == NULL) ||
+			(src == NULL) ||
+			(len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_ECM, dst, src, len);
+}
+
+static int proc_emm_b_cas_card_broker(void *bcas, uint8_t *src, int len)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(src == NULL) ||
+			(len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	return call_card(prv, BROKER_REQUEST_EMM, NULL, src, len);
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_BROKER_PRIVATE_DATA *private_data(void *bcas)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD_BROKER_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+/* queues the request and waits for the broker thread to answer it */
+static int call_card(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, int32_t type, void *dst, uint8_t *src, int len)
+{
+	BROKER_REQUEST req;
+	BROKER_REQUEST *same;
+
+	memset(&req, 0, sizeof(req));
+	req.type = type;
+	req.src = src;
+	req.len = len;
+	req.dst = dst;
+
+	thread_mutex_lock(&(prv->lock));
+
+	same = NULL;
+	if(type == BROKER_REQUEST_ECM){
+		same = find_same_ecm(prv, src, len);
+	}
+	if(same != NULL){
+		/* one transmit answers both */
+		req.next = same->same;
+		same->same = &req;
+	}else{
+		put_request(prv, &req);
+		thread_cond_signal(&(prv->added));
+	}
+
+	while(!req.done){
+		thread_cond_wait(&(prv->done), &(prv->lock));
+	}
+
+	thread_mutex_unlock(&(prv->lock));
+
+	return req.r;
+}
+
+/* an ECM on the card or waiting for it with the same bytes */
+static BROKER_REQUEST *find_same_ecm(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, uint8_t *src, int len)
+{
+	BROKER_REQUEST *p;
+
+	p = prv->busy;
+	if( (p != NULL) && (p->type == BROKER_REQUEST_ECM) &&
+	    (p->len == len) && (memcmp(p->src, src, len) == 0) ){
+		return p;
+	}
+
+	p = prv->queue[BROKER_PRIORITY_ECM].head;
+	while(p != NULL){
+		if( (p->len == len) && (memcmp(p->src, src, len) == 0) ){
+			return p;
+		}
+		p = p->next;
+	}
+
+	return NULL;
+}
+
+static void put_request(B_CAS_CARD_BROKER_PRIVATE_DATA *prv, BROKER_REQUEST *req)
+{
+	BROKER_QUEUE *q;
+
+	if(req->type == BROKER_REQUEST_ECM){
+		q = prv->queue + BROKER_PRIORITY_ECM;
+	}else if(req->type == BROKER_REQUEST_EMM){
+		q = prv->queue + BROKER_PRIORITY_EMM;
+	}else{
+		q = prv->queue + BROKER_PRIORITY_CONTROL;
+	}
+
+	req->next = NULL;
+	if(q->tail != NULL){
+		q->tail->next = req;
+	}else{
+		q->head = req;
+	}
+	q->tail = req;
+}
+
+/* the oldest of the first queue not empty, NULL if all are */
+static BROKER_REQUEST *take_request(B_CAS_CARD_BROKER_PRIVATE_DATA *prv)
+{
+	int i;
+
+	BROKER_QUEUE *q;
+	BROKER_REQUEST *r;
+
+	for(i=0;i<BROKER_PRIORITY_COUNT;i++){
+		q = prv->queue + i;
+		r = q->head;
+		if(r != NULL){
+			q->head = r->next;
+			if(q->head == NULL){
+				q->tail = NULL;
+			}
+			r->next = NULL;
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+static void run_request(B_CAS_CARD *card, BROKER_REQUEST *req)
+{
+	switch(req->type){
+	case BROKER_REQUEST_INIT:
+		req->r = card->init(card);
+		break;
+	case BROKER_REQUEST_INIT_STATUS:
+		req->r = card->get_init_status(card, (B_CAS_INIT_STATUS *)(req->dst));
+		break;
+	case BROKER_REQUEST_ID:
+		req->r = card->get_id(card, (B_CAS_ID *)(req->dst));
+		break;
+	case BROKER_REQUEST_PWR_ON_CTRL:
+		req->r = card->get_pwr_on_ctrl(card, (B_CAS_PWR_ON_CTRL_INFO *)(req->dst));
+		break;
+	case BROKER_REQUEST_ECM:
+		req->r = card->proc_ecm(card, (B_CAS_ECM_RESULT *)(req->dst), req->src, req->len);
+		break;
+	case BROKER_REQUEST_EMM:
+		req->r = card->proc_emm(card, req->src, req->len);
+		break;
+	default:
+		req->r = B_CAS_CARD_ERROR_INVALID_PARAMETER;
+		break;
+	}
+}
+
+/* the only thread that touches the card */
+static THREAD_RESULT THREAD_CALL broker_thread(void *arg)
+{
+	B_CAS_CARD_BROKER_PRIVATE_DATA *prv;
+	BROKER_REQUEST *req;
+	BROKER_REQUEST *p;
+
+	prv = (B_CAS_CARD_BROKER_PRIVATE_DATA *)arg;
+
+	thread_mutex_lock(&(prv->lock));
+	while(!prv->quit){
+		req = take_request(prv);
+		if(req == NULL){
+			thread_cond_wait(&(prv->added), &(prv->lock));
+			continue;
+		}
+
+		prv->busy = req;
+		thread_mutex_unlock(&(prv->lock));
+
+		run_request(prv->card, req);
+
+		thread_mutex_lock(&(prv->lock));
+		prv->busy = NULL;
+
+		/* each merged caller gets a copy in its own dst */
+		p = req->same;
+		while(p != NULL){
+			if(req->r >= 0){
+				memcpy(p->dst, req->dst, sizeof(B_CAS_ECM_RESULT));
+			}
+			p->r = req->r;
+			p->done = 1;
+			p = p->next;
+		}
+		req->done = 1;
+		thread_cond_broadcast(&(prv->done));
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return THREAD_RETURN;
+}
@@ -0,0 +1,622 @@
+#include "b_cas_card.h"
+#include "b_cas_card_error_code.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <winscard.h>
+#if defined(_WIN32)
+#  include <windows.h>
+#  include <tchar.h>
+#else
+#  define TCHAR char
+#  if !defined(__CYGWIN__)
+#    include <wintypes.h>
+#  endif
+#  define _tcslen strlen
+#  define _tcscmp strcmp
+#  define _T(x) x
+#endif
+
+#include "portable_thread.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define MONITOR_READER_MAX     8
+#define MONITOR_ID_MAX        16
+#define MONITOR_ECM_MAX      256
+#define MONITOR_NAME_MAX     256
+
+#define MONITOR_POLL_MSEC    500   /* a reader event is waited so long   */
+#define MONITOR_RETRY_MSEC   100   /* between attempts to reconnect      */
+#define MONITOR_WAIT_MSEC   1000   /* a failed ECM waits so long for it  */
+
+typedef struct {
+
+	B_CAS_CARD                *card;
+
+	THREAD                     thread;
+	THREAD_MUTEX               lock;     /* calls to card and reconnecting */
+	THREAD_COND                back;     /* card reconnected, or quit      */
+	int32_t                    running;
+	int32_t                    quit;
+
+	SCARDCONTEXT               mng;
+
+	int32_t                    lost;
+
+	/* the reader the card is connected to, empty when it is not known */
+	TCHAR                      reader[MONITOR_NAME_MAX];
+
+	/* the ECM that failed, sent again once the card is back */
+	uint8_t                    ecm[MONITOR_ECM_MAX];
+	int32_t                    ecm_len;
+	int32_t                    ecm_done;
+	int                        ecm_r;
+	B_CAS_ECM_RESULT           ecm_res;
+
+	/* kept here, init() of card frees its own */
+	B_CAS_ID                   id;
+	int64_t                    id_data[MONITOR_ID_MAX];
+
+} B_CAS_CARD_MONITOR_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_monitor(void *bcas);
+static int init_b_cas_card_monitor(void *bcas);
+static int get_init_status_b_cas_card_monitor(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_b_cas_card_monitor(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_b_cas_card_monitor(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_b_cas_card_monitor(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_b_cas_card_monitor(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_MONITOR_PRIVATE_DATA *private_data(void *bcas);
+static int start_monitor(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv);
+static void set_lost(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv);
+static void reconnect_card(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv);
+static void load_reader_name(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv);
+static int list_readers(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, LPTSTR *names);
+static int check_reader_change(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, int count, int *relist);
+static int check_reader_present(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, int count);
+static int is_card_reader(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state);
+static THREAD_RESULT THREAD_CALL monitor_thread(void *arg);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+B_CAS_CARD *create_b_cas_card_monitor(B_CAS_CARD *card)
+{
+	int n;
+
+	B_CAS_CARD *r;
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	if(card == NULL){
+		return NULL;
+	}
+
+	n = sizeof(B_CAS_CARD) + sizeof(B_CAS_CARD_MONITOR_PRIVATE_DATA);
+	prv = (B_CAS_CARD_MONITOR_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	prv->card = card;
+
+	if(!thread_mutex_init(&(prv->lock))){
+		free(prv);
+		return NULL;
+	}
+	if(!thread_cond_init(&(prv->back))){
+		thread_mutex_destroy(&(prv->lock));
+		free(prv);
+		return NULL;
+	}
+
+	r = (B_CAS_CARD *)(prv+1);
+
+	r->private_data = prv;
+
+	r->release = release_b_cas_card_monitor;
+	r->init = init_b_cas_card_monitor;
+	r->get_init_status = get_init_status_b_cas_card_monitor;
+	r->get_id = get_id_b_cas_card_monitor;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_b_cas_card_monitor;
+	r->proc_ecm = proc_ecm_b_cas_card_monitor;
+	r->proc_emm = proc_emm_b_cas_card_monitor;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_monitor(void *bcas)
+{
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	if(prv->running){
+		thread_mutex_lock(&(prv->lock));
+		prv->quit = 1;
+		if(prv->mng != 0){
+			SCardCancel(prv->mng);
+		}
+		thread_cond_broadcast(&(prv->back));
+		thread_mutex_unlock(&(prv->lock));
+		thread_join(&(prv->thread));
+	}
+
+	if(prv->mng != 0){
+		SCardReleaseContext(prv->mng);
+		prv->mng = 0;
+	}
+
+	thread_cond_destroy(&(prv->back));
+	thread_mutex_destroy(&(prv->lock));
+
+	prv->card->release(prv->card);
+
+	memset(bcas, 0, sizeof(B_CAS_CARD));
+	free(prv);
+}
+
+static int init_b_cas_card_monitor(void *bcas)
+{
+	int r;
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	r = prv->card->init(prv->card);
+	if(r >= 0){
+		prv->lost = 0;
+		load_reader_name(prv);
+		if(!prv->running){
+			/* watching starts with the first card found */
+			r = start_monitor(prv);
+		}
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int get_init_status_b_cas_card_monitor(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	int r;
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (stat == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	r = prv->card->get_init_status(prv->card, stat);
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int get_id_b_cas_card_monitor(void *bcas, B_CAS_ID *dst)
+{
+	int r;
+
+	B_CAS_ID id;
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	r = prv->card->get_id(prv->card, &id);
+	if(r >= 0){
+		if(id.count > MONITOR_ID_MAX){
+			id.count = MONITOR_ID_MAX;
+		}
+		memcpy(prv->id_data, id.data, id.count*sizeof(int64_t));
+		prv->id.data = prv->id_data;
+		prv->id.count = id.count;
+		memcpy(dst, &(prv->id), sizeof(B_CAS_ID));
+	}else if(r == B_CAS_CARD_ERROR_TRANSMIT_FAILED){
+		set_lost(prv);
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int get_pwr_on_ctrl_b_cas_card_monitor(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	int r;
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	r = prv->card->get_pwr_on_ctrl(prv->card, dst);
+	if(r == B_CAS_CARD_ERROR_TRANSMIT_FAILED){
+		set_lost(prv);
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int proc_ecm_b_cas_card_monitor(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	int r;
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(dst == NULL) ||
+			(src == NULL) ||
+			(len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+
+	if(!prv->lost){
+		r = prv->card->proc_ecm(prv->card, dst, src, len);
+		if( (r != B_CAS_CARD_ERROR_TRANSMIT_FAILED) || (!prv->running) ){
+			thread_mutex_unlock(&(prv->lock));
+			return r;
+		}
+		set_lost(prv);
+	}
+
+	if( (prv->ecm_len > 0) || (len > MONITOR_ECM_MAX) ){
+		/* another one is waiting already */
+		thread_mutex_unlock(&(prv->lock));
+		return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+
+	/* the monitor sends it as soon as the card is back */
+	memcpy(prv->ecm, src, len);
+	prv->ecm_len = len;
+	prv->ecm_done = 0;
+
+	while( (!prv->ecm_done) && (!prv->quit) ){
+		if(!thread_cond_timedwait(&(prv->back), &(prv->lock), MONITOR_WAIT_MSEC)){
+			break;
+		}
+	}
+
+	if(prv->ecm_done){
+		r = prv->ecm_r;
+		memcpy(dst, &(prv->ecm_res), sizeof(B_CAS_ECM_RESULT));
+	}else{
+		r = B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+	prv->ecm_len = 0;
+	prv->ecm_done = 0;
+
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int proc_emm_b_cas_card_monitor(void *bcas, uint8_t *src, int len)
+{
+	int r;
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(src == NULL) ||
+			(len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	if(prv->lost){
+		/* dropped, the same EMM comes again */
+		r = 0;
+	}else{
+		r = prv->card->proc_emm(prv->card, src, len);
+		if(r == B_CAS_CARD_ERROR_TRANSMIT_FAILED){
+			set_lost(prv);
+		}
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_MONITOR_PRIVATE_DATA *private_data(void *bcas)
+{
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD_MONITOR_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static int start_monitor(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv)
+{
+	long ret;
+
+	ret = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &(prv->mng));
+	if(ret != SCARD_S_SUCCESS){
+		prv->mng = 0;
+		return B_CAS_CARD_ERROR_NO_SMART_CARD_READER;
+	}
+
+	if(!thread_create(&(prv->thread), monitor_thread, prv)){
+		SCardReleaseContext(prv->mng);
+		prv->mng = 0;
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	prv->running = 1;
+
+	return 0;
+}
+
+/* called with lock held, wakes the monitor up to reconnect */
+static void set_lost(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv)
+{
+	if(!prv->running){
+		/* nobody to reconnect */
+		return;
+	}
+
+	prv->lost = 1;
+	if(prv->mng != 0){
+		SCardCancel(prv->mng);
+	}
+}
+
+/* called with lock held */
+static void reconnect_card(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv)
+{
+	int r;
+
+	/* connects and sends the initial setting command again */
+	r = prv->card->init(prv->card);
+	if(r < 0){
+		return;
+	}
+
+	prv->lost = 0;
+	load_reader_name(prv);
+
+	if( (prv->ecm_len > 0) && (!prv->ecm_done) ){
+		prv->ecm_r = prv->card->proc_ecm(prv->card, &(prv->ecm_res), prv->ecm, prv->ecm_len);
+		prv->ecm_done = 1;
+		if(prv->ecm_r == B_CAS_CARD_ERROR_TRANSMIT_FAILED){
+			prv->lost = 1;
+		}
+	}
+
+	thread_cond_broadcast(&(prv->back));
+}
+
+/* init() may have picked another reader */
+static void load_reader_name(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv)
+{
+	if(get_b_cas_card_reader_name(prv->card, prv->reader, MONITOR_NAME_MAX) < 0){
+		/* not a card of create_b_cas_card(), every reader counts */
+		prv->reader[0] = 0;
+	}
+}
+
+/* every reader and the PnP notification last, the states as they are now */
+static int list_readers(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, LPTSTR *names)
+{
+	int i,n;
+	long ret;
+	unsigned long len;
+
+	LPTSTR p;
+
+	if(*names != NULL){
+		free(*names);
+		*names = NULL;
+	}
+
+	n = 0;
+
+	ret = SCardListReaders(prv->mng, NULL, NULL, &len);
+	if(ret == SCARD_S_SUCCESS){
+		*names = (LPTSTR)malloc(sizeof(TCHAR)*len);
+	}
+	if(*names != NULL){
+		ret = SCardListReaders(prv->mng, NULL, *names, &len);
+		p = *names;
+		while( (ret == SCARD_S_SUCCESS) && (p[0] != 0) && (n < MONITOR_READER_MAX) ){
+			memset(state+n, 0, sizeof(SCARD_READERSTATE));
+			state[n].szReader = p;
+			state[n].dwCurrentState = SCARD_STATE_UNAWARE;
+			n += 1;
+			p += (_tcslen(p) + 1);
+		}
+	}
+
+	memset(state+n, 0, sizeof(SCARD_READERSTATE));
+	state[n].szReader = _T("\\\\?PnP?\\Notification");
+	state[n].dwCurrentState = (n << 16);
+	n += 1;
+
+	ret = SCardGetStatusChange(prv->mng, 0, state, n);
+	if(ret == SCARD_S_SUCCESS){
+		for(i=0;i<n;i++){
+			state[i].dwCurrentState = state[i].dwEventState & ~SCARD_STATE_CHANGED;
+		}
+	}
+
+	return n;
+}
+
+/* 1 if the reader in use has lost its card. relist - the readers have changed */
+static int check_reader_change(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, int count, int *relist)
+{
+	int i,r;
+
+	DWORD s;
+
+	r = 0;
+	*relist = 0;
+
+	for(i=0;i<count;i++){
+		s = state[i].dwEventState;
+		if(!(s & SCARD_STATE_CHANGED)){
+			continue;
+		}
+		state[i].dwCurrentState = s & ~SCARD_STATE_CHANGED;
+		if(i == count-1){
+			*relist = 1;
+			continue;
+		}
+		if(s & (SCARD_STATE_UNAVAILABLE|SCARD_STATE_UNKNOWN)){
+			*relist = 1;
+		}
+		if(!is_card_reader(prv, state+i)){
+			continue;
+		}
+		if(s & (SCARD_STATE_EMPTY|SCARD_STATE_UNAVAILABLE|SCARD_STATE_UNKNOWN|SCARD_STATE_MUTE)){
+			r = 1;
+		}
+	}
+
+	return r;
+}
+
+/* 0 if the reader in use has gone from a new list or holds no card */
+static int check_reader_present(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state, int count)
+{
+	int i;
+
+	if(prv->reader[0] == 0){
+		/* can not tell, reconnect to be sure */
+		return 0;
+	}
+
+	for(i=0;i<count-1;i++){
+		if(!is_card_reader(prv, state+i)){
+			continue;
+		}
+		if(state[i].dwCurrentState & (SCARD_STATE_EMPTY|SCARD_STATE_UNAVAILABLE|SCARD_STATE_UNKNOWN|SCARD_STATE_MUTE)){
+			return 0;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+static int is_card_reader(B_CAS_CARD_MONITOR_PRIVATE_DATA *prv, SCARD_READERSTATE *state)
+{
+	if(prv->reader[0] == 0){
+		return 1;
+	}
+
+	return (_tcscmp(state->szReader, prv->reader) == 0);
+}
+
+static THREAD_RESULT THREAD_CALL monitor_thread(void *arg)
+{
+	int n,relist;
+	long ret;
+	DWORD wait;
+
+	LPTSTR names;
+	SCARD_READERSTATE state[MONITOR_READER_MAX+1];
+
+	B_CAS_CARD_MONITOR_PRIVATE_DATA *prv;
+
+	prv = (B_CAS_CARD_MONITOR_PRIVATE_DATA *)arg;
+
+	names = NULL;
+
+	thread_mutex_lock(&(prv->lock));
+	n = list_readers(prv, state, &names);
+
+	while(!prv->quit){
+		if(prv->lost){
+			reconnect_card(prv);
+		}
+		wait = prv->lost ? MONITOR_RETRY_MSEC : MONITOR_POLL_MSEC;
+		thread_mutex_unlock(&(prv->lock));
+
+		ret = SCardGetStatusChange(prv->mng, wait, state, n);
+
+		thread_mutex_lock(&(prv->lock));
+		if( (ret == SCARD_E_TIMEOUT) || (ret == SCARD_E_CANCELLED) ){
+			continue;
+		}
+
+		if(ret != SCARD_S_SUCCESS){
+			/* a reader gone or the service restarted, start over */
+			if(prv->mng != 0){
+				SCardReleaseContext(prv->mng);
+			}
+			ret = SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, &(prv->mng));
+			if(ret != SCARD_S_SUCCESS){
+				prv->mng = 0;
+			}
+			prv->lost = 1;
+			thread_cond_timedwait(&(prv->back), &(prv->lock), MONITOR_RETRY_MSEC);
+			n = list_readers(prv, state, &names);
+			continue;
+		}
+
+		if(check_reader_change(prv, state, n, &relist)){
+			prv->lost = 1;
+		}
+		if(relist){
+			n = list_readers(prv, state, &names);
+			if(!check_reader_present(prv, state, n)){
+				prv->lost = 1;
+			}
+		}
+	}
+
+	thread_mutex_unlock(&(prv->lock));
+
+	if(names != NULL){
+		free(names);
+	}
+
+	return THREAD_RETURN;
+}
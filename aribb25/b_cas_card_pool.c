@@ -0,0 +1,524 @@
+#include "b_cas_card.h"
+#include "b_cas_card_error_code.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "portable_thread.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define B_CAS_CARD_POOL_MAX 8
+
+typedef struct {
+	B_CAS_CARD                *card;
+	THREAD_MUTEX               lock;     /* one call on the card at a time */
+	int32_t                    busy;     /* calls on the card or waiting  */
+	int32_t                    healthy;
+	int64_t                    done;     /* calls answered                */
+	B_CAS_ID                   id;
+} POOL_MEMBER;
+
+typedef struct {
+
+	THREAD_MUTEX               lock;
+
+	POOL_MEMBER                member[B_CAS_CARD_POOL_MAX];
+	int32_t                    count;
+
+	B_CAS_INIT_STATUS          stat;
+
+	B_CAS_ID                   id;       /* of all members */
+	int32_t                    id_max;
+
+} B_CAS_CARD_POOL_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_pool(void *bcas);
+static int init_b_cas_card_pool(void *bcas);
+static int get_init_status_b_cas_card_pool(void *bcas, B_CAS_INIT_STATUS *stat);
+static int get_id_b_cas_card_pool(void *bcas, B_CAS_ID *dst);
+static int get_pwr_on_ctrl_b_cas_card_pool(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst);
+static int proc_ecm_b_cas_card_pool(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len);
+static int proc_emm_b_cas_card_pool(void *bcas, uint8_t *src, int len);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_POOL_PRIVATE_DATA *private_data(void *bcas);
+static void teardown(B_CAS_CARD_POOL_PRIVATE_DATA *prv);
+static int add_member(B_CAS_CARD_POOL_PRIVATE_DATA *prv, B_CAS_CARD *card);
+static int check_same_system(B_CAS_INIT_STATUS *a, B_CAS_INIT_STATUS *b);
+static POOL_MEMBER *select_member(B_CAS_CARD_POOL_PRIVATE_DATA *prv, uint32_t tried);
+static POOL_MEMBER *find_member_by_id(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int64_t card_id);
+static void finish_call(B_CAS_CARD_POOL_PRIVATE_DATA *prv, POOL_MEMBER *m, int r);
+static int64_t load_be_uint48(uint8_t *p);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+B_CAS_CARD *create_b_cas_card_pool(void)
+{
+	int n;
+
+	B_CAS_CARD *r;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	n = sizeof(B_CAS_CARD) + sizeof(B_CAS_CARD_POOL_PRIVATE_DATA);
+	prv = (B_CAS_CARD_POOL_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		return NULL;
+	}
+
+	if(!thread_mutex_init(&(prv->lock))){
+		free(prv);
+		return NULL;
+	}
+
+	r = (B_CAS_CARD *)(prv+1);
+
+	r->private_data = prv;
+
+	r->release = release_b_cas_card_pool;
+	r->init = init_b_cas_card_pool;
+	r->get_init_status = get_init_status_b_cas_card_pool;
+	r->get_id = get_id_b_cas_card_pool;
+	r->get_pwr_on_ctrl = get_pwr_on_ctrl_b_cas_card_pool;
+	r->proc_ecm = proc_ecm_b_cas_card_pool;
+	r->proc_emm = proc_emm_b_cas_card_pool;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ interface method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_b_cas_card_pool(void *bcas)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		/* do nothing */
+		return;
+	}
+
+	teardown(prv);
+	thread_mutex_destroy(&(prv->lock));
+
+	memset(bcas, 0, sizeof(B_CAS_CARD));
+	free(prv);
+}
+
+static int init_b_cas_card_pool(void *bcas)
+{
+	int i,n;
+
+	B_CAS_CARD *card;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if(prv == NULL){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	teardown(prv);
+
+	for(i=0;prv->count<B_CAS_CARD_POOL_MAX;i++){
+		card = create_b_cas_card();
+		if(card == NULL){
+			n = B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+			goto LAST;
+		}
+
+		n = init_b_cas_card_by_index(card, i);
+		if(n == B_CAS_CARD_ERROR_ALL_READERS_CONNECTION_FAILED){
+			/* empty reader */
+			card->release(card);
+			continue;
+		}
+		if(n == B_CAS_CARD_ERROR_NO_SMART_CARD_READER){
+			/* no more readers */
+			card->release(card);
+			break;
+		}
+		if(n < 0){
+			card->release(card);
+			goto LAST;
+		}
+
+		n = add_member(prv, card);
+		if(n < 0){
+			/* a card of another system, or no memory left */
+			card->release(card);
+			if(n == B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY){
+				goto LAST;
+			}
+		}
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_ALL_READERS_CONNECTION_FAILED;
+	}
+
+	return 0;
+
+LAST:
+	teardown(prv);
+	return n;
+}
+
+static int get_init_status_b_cas_card_pool(void *bcas, B_CAS_INIT_STATUS *stat)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (stat == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	memcpy(stat, &(prv->stat), sizeof(B_CAS_INIT_STATUS));
+
+	return 0;
+}
+
+static int get_id_b_cas_card_pool(void *bcas, B_CAS_ID *dst)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	memcpy(dst, &(prv->id), sizeof(B_CAS_ID));
+
+	return 0;
+}
+
+static int get_pwr_on_ctrl_b_cas_card_pool(void *bcas, B_CAS_PWR_ON_CTRL_INFO *dst)
+{
+	int r;
+
+	POOL_MEMBER *m;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) || (dst == NULL) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	m = select_member(prv, 0);
+	thread_mutex_unlock(&(prv->lock));
+	if(m == NULL){
+		return B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	}
+
+	thread_mutex_lock(&(m->lock));
+	r = m->card->get_pwr_on_ctrl(m->card, dst);
+	thread_mutex_unlock(&(m->lock));
+
+	finish_call(prv, m, r);
+
+	return r;
+}
+
+static int proc_ecm_b_cas_card_pool(void *bcas, B_CAS_ECM_RESULT *dst, uint8_t *src, int len)
+{
+	int r;
+	uint32_t tried;
+
+	POOL_MEMBER *m;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(dst == NULL) ||
+			(src == NULL) ||
+			(len < 1) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	r = B_CAS_CARD_ERROR_TRANSMIT_FAILED;
+	tried = 0;
+
+	while(1){
+		thread_mutex_lock(&(prv->lock));
+		m = select_member(prv, tried);
+		thread_mutex_unlock(&(prv->lock));
+		if(m == NULL){
+			/* every card failed it */
+			break;
+		}
+
+		thread_mutex_lock(&(m->lock));
+		r = m->card->proc_ecm(m->card, dst, src, len);
+		thread_mutex_unlock(&(m->lock));
+
+		finish_call(prv, m, r);
+		if(r >= 0){
+			break;
+		}
+
+		tried |= (1 << (m - prv->member));
+	}
+
+	return r;
+}
+
+static int proc_emm_b_cas_card_pool(void *bcas, uint8_t *src, int len)
+{
+	int r;
+
+	POOL_MEMBER *m;
+	B_CAS_CARD_POOL_PRIVATE_DATA *prv;
+
+	prv = private_data(bcas);
+	if( (prv == NULL) ||
+			(src == NULL) ||
+			(len < 6) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	if(prv->count == 0){
+		return B_CAS_CARD_ERROR_NOT_INITIALIZED;
+	}
+
+	/* an EMM is for the card whose id it carries */
+	thread_mutex_lock(&(prv->lock));
+	m = find_member_by_id(prv, load_be_uint48(src));
+	if(m != NULL){
+		m->busy += 1;
+	}
+	thread_mutex_unlock(&(prv->lock));
+	if(m == NULL){
+		return 0;
+	}
+
+	thread_mutex_lock(&(m->lock));
+	r = m->card->proc_emm(m->card, src, len);
+	thread_mutex_unlock(&(m->lock));
+
+	finish_call(prv, m, r);
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ private method implementation
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static B_CAS_CARD_POOL_PRIVATE_DATA *private_data(void *bcas)
+{
+	B_CAS_CARD_POOL_PRIVATE_DATA *r;
+	B_CAS_CARD *p;
+
+	p = (B_CAS_CARD *)bcas;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (B_CAS_CARD_POOL_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != ((void *)p) ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static void teardown(B_CAS_CARD_POOL_PRIVATE_DATA *prv)
+{
+	int i;
+
+	POOL_MEMBER *m;
+
+	for(i=0;i<prv->count;i++){
+		m = prv->member + i;
+		m->card->release(m->card);
+		thread_mutex_destroy(&(m->lock));
+	}
+	memset(prv->member, 0, sizeof(prv->member));
+	prv->count = 0;
+
+	if(prv->id.data != NULL){
+		free(prv->id.data);
+	}
+	memset(&(prv->id), 0, sizeof(B_CAS_ID));
+	prv->id_max = 0;
+
+	memset(&(prv->stat), 0, sizeof(B_CAS_INIT_STATUS));
+}
+
+static int add_member(B_CAS_CARD_POOL_PRIVATE_DATA *prv, B_CAS_CARD *card)
+{
+	int n;
+
+	int64_t *p;
+
+	B_CAS_INIT_STATUS stat;
+	B_CAS_ID id;
+	POOL_MEMBER *m;
+
+	n = card->get_init_status(card, &stat);
+	if(n < 0){
+		return n;
+	}
+
+	/* the decoders see one card, all of them must decrypt the same way */
+	if( (prv->count > 0) && !check_same_system(&(prv->stat), &stat) ){
+		return B_CAS_CARD_ERROR_INVALID_PARAMETER;
+	}
+
+	n = card->get_id(card, &id);
+	if(n < 0){
+		return n;
+	}
+
+	if(prv->id.count + id.count > prv->id_max){
+		n = prv->id.count + id.count + 4;
+		p = (int64_t *)realloc(prv->id.data, n*sizeof(int64_t));
+		if(p == NULL){
+			return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+		}
+		prv->id.data = p;
+		prv->id_max = n;
+	}
+
+	m = prv->member + prv->count;
+	if(!thread_mutex_init(&(m->lock))){
+		return B_CAS_CARD_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	m->card = card;
+	m->busy = 0;
+	m->healthy = 1;
+	m->done = 0;
+	m->id.data = prv->id.data + prv->id.count;
+	m->id.count = id.count;
+	memcpy(m->id.data, id.data, id.count*sizeof(int64_t));
+
+	if(prv->count == 0){
+		memcpy(&(prv->stat), &stat, sizeof(B_CAS_INIT_STATUS));
+	}
+
+	prv->id.count += id.count;
+	prv->count += 1;
+
+	/* realloc may have moved the ids */
+	p = prv->id.data;
+	for(n=0;n<prv->count;n++){
+		prv->member[n].id.data = p;
+		p += prv->member[n].id.count;
+	}
+
+	return 0;
+}
+
+static int check_same_system(B_CAS_INIT_STATUS *a, B_CAS_INIT_STATUS *b)
+{
+	if(a->ca_system_id != b->ca_system_id){
+		return 0;
+	}
+
+	if(memcmp(a->system_key, b->system_key, sizeof(a->system_key)) != 0){
+		return 0;
+	}
+
+	if(memcmp(a->init_cbc, b->init_cbc, sizeof(a->init_cbc)) != 0){
+		return 0;
+	}
+
+	return 1;
+}
+
+/* the healthy member with the fewest calls on it, not in tried. takes a
+   call on it, finish_call() gives it back */
+static POOL_MEMBER *select_member(B_CAS_CARD_POOL_PRIVATE_DATA *prv, uint32_t tried)
+{
+	int i;
+
+	POOL_MEMBER *m;
+	POOL_MEMBER *r;
+
+	r = NULL;
+	for(i=0;i<prv->count;i++){
+		m = prv->member + i;
+		if( (!m->healthy) || (tried & (1 << i)) ){
+			continue;
+		}
+		if( (r == NULL) ||
+		    (m->busy < r->busy) ||
+		    ( (m->busy == r->busy) && (m->done < r->done) ) ){
+			r = m;
+		}
+	}
+
+	if(r != NULL){
+		r->busy += 1;
+	}
+
+	return r;
+}
+
+static POOL_MEMBER *find_member_by_id(B_CAS_CARD_POOL_PRIVATE_DATA *prv, int64_t card_id)
+{
+	int i,j;
+
+	POOL_MEMBER *m;
+
+	for(i=0;i<prv->count;i++){
+		m = prv->member + i;
+		for(j=0;j<m->id.count;j++){
+			if(m->id.data[j] == card_id){
+				return m;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* a card that could not answer is left out from then on */
+static void finish_call(B_CAS_CARD_POOL_PRIVATE_DATA *prv, POOL_MEMBER *m, int r)
+{
+	thread_mutex_lock(&(prv->lock));
+	m->busy -= 1;
+	m->done += 1;
+	if(r == B_CAS_CARD_ERROR_TRANSMIT_FAILED){
+		m->healthy = 0;
+	}
+	thread_mutex_unlock(&(prv->lock));
+}
+
+static int64_t load_be_uint48(uint8_t *p)
+{
+	int i;
+	int64_t r;
+
+	r = p[0];
+	for(i=1;i<6;i++){
+		r <<= 8;
+		r |= p[i];
+	}
+
+	return r;
+}
@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ecm_cache.h"
+#include "ecm_cache_error_code.h"
+
+#include "portable_thread.h"
+#include "portable_time.h"
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ inner structures
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+typedef struct {
+	int32_t                 table_id;
+	uint32_t                crc;
+	int32_t                 len;
+	uint8_t                *data;
+	int64_t                 time;      /* get_msec() of the card answer */
+	B_CAS_ECM_RESULT        res;
+} ECM_CACHE_ENTRY;
+
+typedef struct {
+
+	THREAD_MUTEX            lock;
+	int32_t                 ref;
+
+	int32_t                 max_count;
+	int32_t                 max_msec;
+
+	ECM_CACHE_ENTRY        *entry;
+	int32_t                 count;
+
+	ECM_CACHE_STAT          stat;
+
+} ECM_CACHE_PRIVATE_DATA;
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ constant values
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+#define DEFAULT_MAX_COUNT 256
+#define DEFAULT_MAX_MSEC  (10*60*1000)
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_cache(void *cache);
+static int add_ref_ecm_cache(void *cache);
+static int set_limit_ecm_cache(void *cache, int32_t max_count, int32_t max_msec);
+static int get_ecm_cache(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *dst);
+static int put_ecm_cache(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *res);
+static int clear_ecm_cache(void *cache);
+static int get_stat_ecm_cache(void *cache, ECM_CACHE_STAT *stat);
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ global function implementation (factory method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+ECM_CACHE *create_ecm_cache(void)
+{
+	ECM_CACHE *r;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	int n;
+
+	n  = sizeof(ECM_CACHE_PRIVATE_DATA);
+	n += sizeof(ECM_CACHE);
+
+	prv = (ECM_CACHE_PRIVATE_DATA *)calloc(1, n);
+	if(prv == NULL){
+		/* failed on malloc() - no enough memory */
+		return NULL;
+	}
+
+	prv->entry = (ECM_CACHE_ENTRY *)calloc(DEFAULT_MAX_COUNT, sizeof(ECM_CACHE_ENTRY));
+	if( (prv->entry == NULL) || !thread_mutex_init(&(prv->lock)) ){
+		free(prv->entry);
+		free(prv);
+		return NULL;
+	}
+
+	prv->ref = 1;
+	prv->max_count = DEFAULT_MAX_COUNT;
+	prv->max_msec = DEFAULT_MAX_MSEC;
+
+	r = (ECM_CACHE *)(prv+1);
+	r->private_data = prv;
+
+	r->release = release_ecm_cache;
+	r->add_ref = add_ref_ecm_cache;
+
+	r->set_limit = set_limit_ecm_cache;
+
+	r->get = get_ecm_cache;
+	r->put = put_ecm_cache;
+
+	r->clear = clear_ecm_cache;
+
+	r->get_stat = get_stat_ecm_cache;
+
+	return r;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function prototypes (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_CACHE_PRIVATE_DATA *private_data(void *cache);
+
+static ECM_CACHE_ENTRY *find_entry(ECM_CACHE_PRIVATE_DATA *prv, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len);
+static void expire_entries(ECM_CACHE_PRIVATE_DATA *prv, int64_t now);
+static void remove_entry(ECM_CACHE_PRIVATE_DATA *prv, ECM_CACHE_ENTRY *entry);
+static ECM_CACHE_ENTRY *find_oldest_entry(ECM_CACHE_PRIVATE_DATA *prv);
+
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function implementation (interface method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static void release_ecm_cache(void *cache)
+{
+	int32_t n;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if(prv == NULL){
+		return;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	prv->ref -= 1;
+	n = prv->ref;
+	thread_mutex_unlock(&(prv->lock));
+	if(n > 0){
+		return;
+	}
+
+	clear_ecm_cache(cache);
+	free(prv->entry);
+	thread_mutex_destroy(&(prv->lock));
+
+	memset(cache, 0, sizeof(ECM_CACHE));
+	free(prv);
+}
+
+static int add_ref_ecm_cache(void *cache)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if(prv == NULL){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	prv->ref += 1;
+	thread_mutex_unlock(&(prv->lock));
+
+	return 0;
+}
+
+static int set_limit_ecm_cache(void *cache, int32_t max_count, int32_t max_msec)
+{
+	ECM_CACHE_ENTRY *p;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if( (prv == NULL) || (max_count < 1) || (max_msec < 0) ){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+
+	/* the oldest go first */
+	while(prv->count > max_count){
+		remove_entry(prv, find_oldest_entry(prv));
+	}
+
+	p = (ECM_CACHE_ENTRY *)realloc(prv->entry, max_count * sizeof(ECM_CACHE_ENTRY));
+	if(p == NULL){
+		thread_mutex_unlock(&(prv->lock));
+		return ECM_CACHE_ERROR_NO_ENOUGH_MEMORY;
+	}
+
+	prv->entry = p;
+	prv->max_count = max_count;
+	prv->max_msec = max_msec;
+
+	thread_mutex_unlock(&(prv->lock));
+
+	return 0;
+}
+
+static int get_ecm_cache(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *dst)
+{
+	int r;
+
+	ECM_CACHE_ENTRY *entry;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if( (prv == NULL) || (data == NULL) || (len < 1) || (dst == NULL) ){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+
+	expire_entries(prv, get_msec());
+
+	entry = find_entry(prv, table_id, crc, data, len);
+	if(entry != NULL){
+		memcpy(dst, &(entry->res), sizeof(B_CAS_ECM_RESULT));
+		prv->stat.hit += 1;
+		r = 1;
+	}else{
+		prv->stat.miss += 1;
+		r = 0;
+	}
+
+	thread_mutex_unlock(&(prv->lock));
+
+	return r;
+}
+
+static int put_ecm_cache(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *res)
+{
+	int64_t now;
+
+	ECM_CACHE_ENTRY *entry;
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if( (prv == NULL) || (data == NULL) || (len < 1) || (res == NULL) ){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+
+	now = get_msec();
+	expire_entries(prv, now);
+
+	entry = find_entry(prv, table_id, crc, data, len);
+	if(entry == NULL){
+		if(prv->count >= prv->max_count){
+			remove_entry(prv, find_oldest_entry(prv));
+		}
+		entry = prv->entry + prv->count;
+		entry->data = (uint8_t *)malloc(len);
+		if(entry->data == NULL){
+			thread_mutex_unlock(&(prv->lock));
+			return ECM_CACHE_ERROR_NO_ENOUGH_MEMORY;
+		}
+		memcpy(entry->data, data, len);
+		entry->table_id = table_id;
+		entry->crc = crc;
+		entry->len = len;
+		prv->count += 1;
+	}
+
+	memcpy(&(entry->res), res, sizeof(B_CAS_ECM_RESULT));
+	entry->time = now;
+
+	prv->stat.count = prv->count;
+
+	thread_mutex_unlock(&(prv->lock));
+
+	return 0;
+}
+
+static int clear_ecm_cache(void *cache)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if(prv == NULL){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	while(prv->count > 0){
+		remove_entry(prv, prv->entry + prv->count - 1);
+	}
+	thread_mutex_unlock(&(prv->lock));
+
+	return 0;
+}
+
+static int get_stat_ecm_cache(void *cache, ECM_CACHE_STAT *stat)
+{
+	ECM_CACHE_PRIVATE_DATA *prv;
+
+	prv = private_data(cache);
+	if( (prv == NULL) || (stat == NULL) ){
+		return ECM_CACHE_ERROR_INVALID_PARAM;
+	}
+
+	thread_mutex_lock(&(prv->lock));
+	memcpy(stat, &(prv->stat), sizeof(ECM_CACHE_STAT));
+	thread_mutex_unlock(&(prv->lock));
+
+	return 0;
+}
+
+/*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+ function implementation (private method)
+ ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+static ECM_CACHE_PRIVATE_DATA *private_data(void *cache)
+{
+	ECM_CACHE_PRIVATE_DATA *r;
+	ECM_CACHE *p;
+
+	p = (ECM_CACHE *)cache;
+	if(p == NULL){
+		return NULL;
+	}
+
+	r = (ECM_CACHE_PRIVATE_DATA *)(p->private_data);
+	if( ((void *)(r+1)) != cache ){
+		return NULL;
+	}
+
+	return r;
+}
+
+static ECM_CACHE_ENTRY *find_entry(ECM_CACHE_PRIVATE_DATA *prv, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len)
+{
+	int32_t i;
+	ECM_CACHE_ENTRY *p;
+
+	/* a few hundred entries at most, looked up a few times a second */
+	for(i=0;i<prv->count;i++){
+		p = prv->entry + i;
+		if( (p->crc == crc) && (p->len == len) && (p->table_id == table_id) &&
+		    (memcmp(p->data, data, len) == 0) ){
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static void expire_entries(ECM_CACHE_PRIVATE_DATA *prv, int64_t now)
+{
+	int32_t i;
+
+	if(prv->max_msec == 0){
+		return;
+	}
+
+	i = 0;
+	while(i < prv->count){
+		if( (now - prv->entry[i].time) >= prv->max_msec ){
+			/* the last one moves here */
+			remove_entry(prv, prv->entry + i);
+			prv->stat.expired += 1;
+		}else{
+			i += 1;
+		}
+	}
+}
+
+static void remove_entry(ECM_CACHE_PRIVATE_DATA *prv, ECM_CACHE_ENTRY *entry)
+{
+	ECM_CACHE_ENTRY *last;
+
+	free(entry->data);
+
+	last = prv->entry + prv->count - 1;
+	if(entry != last){
+		memcpy(entry, last, sizeof(ECM_CACHE_ENTRY));
+	}
+	memset(last, 0, sizeof(ECM_CACHE_ENTRY));
+
+	prv->count -= 1;
+	prv->stat.count = prv->count;
+}
+
+static ECM_CACHE_ENTRY *find_oldest_entry(ECM_CACHE_PRIVATE_DATA *prv)
+{
+	int32_t i;
+	ECM_CACHE_ENTRY *r;
+
+	r = prv->entry;
+	for(i=1;i<prv->count;i++){
+		if(prv->entry[i].time < r->time){
+			r = prv->entry + i;
+		}
+	}
+
+	return r;
+}
@@ -0,0 +1,53 @@
+#ifndef ECM_CACHE_H
+#define ECM_CACHE_H
+
+#include "portable.h"
+#include "b_cas_card.h"
+
+/* card answers to ECM sections, kept in memory for the decoders that
+   share the cache. an entry is found by table_id, the CRC and the
+   length of its section, the data is compared as well */
+
+typedef struct {
+	int64_t hit;        /* answered from the cache     */
+	int64_t miss;       /* sent to the card            */
+	int64_t expired;    /* entries dropped for age     */
+	int32_t count;      /* entries now                 */
+} ECM_CACHE_STAT;
+
+typedef struct {
+
+	void *private_data;
+
+	void (* release)(void *cache);
+	int (* add_ref)(void *cache);
+
+	/* max_count entries, each for max_msec (0 - no expiry) after the
+	   card answered. 256 and 10 minutes to start with */
+	int (* set_limit)(void *cache, int32_t max_count, int32_t max_msec);
+
+	/* data and len - the ECM as sent to the card, crc - the CRC_32 of
+	   its section. get returns 1 and fills dst if there is an entry,
+	   0 if not */
+	int (* get)(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *dst);
+	int (* put)(void *cache, int32_t table_id, uint32_t crc, uint8_t *data, int32_t len, B_CAS_ECM_RESULT *res);
+
+	int (* clear)(void *cache);
+
+	int (* get_stat)(void *cache, ECM_CACHE_STAT *stat);
+
+} ECM_CACHE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one reference, release() drops it, the methods may be called from
+   several threads */
+extern ECM_CACHE *create_ecm_cache(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ECM_CACHE_H */
@@ -0,0 +1,7 @@
+#ifndef ECM_CACHE_ERROR_CODE_H
+#define ECM_CACHE_ERROR_CODE_H
+
+#define ECM_CACHE_ERROR_INVALID_PARAM        -1
+#define ECM_CACHE_ERROR_NO_ENOUGH_MEMORY     -2
+
+#endif /* ECM_CACHE_ERROR_CODE_H */
@@ -73,15 +73,24 @@ void CB25Decoder::Release()
 
 const BOOL CB25Decoder::Initialize(DWORD dwRound)
 {
+	B_CAS_CARD *card;
+
 	std::lock_guard<std::mutex> lock(_mtx);
 
 	if (_b25)
 		return Reset();
 
-	_bcas = create_b_cas_card();
-	if (!_bcas)
+	card = create_b_cas_card();
+	if (!card)
 		return FALSE;
 
+	// カードが抜けたりリセットされたりしたらバックグラウンドで再接続する
+	_bcas = create_b_cas_card_monitor(card);
+	if (!_bcas) {
+		card->release(card);
+		return FALSE;
+	}
+
 	if (_bcas->init(_bcas) < 0)
 		goto err;
 
@@ -181,13 +190,8 @@ const BOOL CB25Decoder::Decode(BYTE *pSrcBuf, const DWORD dwSrcSize, BYTE **ppDs
 				}
 			}
 
-			if (rc == ARIB_STD_B25_ERROR_ECM_PROC_FAILURE) {
-				// pass through
-				_b25->release(_b25);
-				_b25 = nullptr;
-				_bcas->release(_bcas);
-				_bcas = nullptr;
-			}
+			// ECM_PROC_FAILURE では _b25/_bcas を解放しない
+			// _bcas のモニターがバックグラウンドで再接続し、次の put() で同じ ECM からやり直す
 		}
 		_errtime = time(nullptr);
 		return FALSE;	// error
@@ -79,6 +79,10 @@ static int clear_scramble_key_multi2(void *m2);
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, intptr_t size);
 static int decrypt_with_simd_multi2(void *m2, int32_t type, uint8_t *buf, intptr_t size);
+static int decrypt_to_multi2(void *m2, int32_t type, const uint8_t *src, uint8_t *dst, int32_t size);
+static int decrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
+static const char *get_kernel_name_multi2(void *m2);
+static int encrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
@@ -115,6 +119,10 @@ MULTI2 *create_multi2(void)
 	r->clear_scramble_key = clear_scramble_key_multi2;
 	r->encrypt = encrypt_multi2;
 	r->decrypt = decrypt_multi2;
+	r->decrypt_to = decrypt_to_multi2;
+	r->decrypt_batch = decrypt_batch_multi2;
+	r->get_kernel_name = get_kernel_name_multi2;
+	r->encrypt_batch = encrypt_batch_multi2;
 
 	return r;
 }
@@ -136,6 +144,7 @@ static void core_pi4(CORE_DATA *dst, CORE_DATA *src, uint32_t a);
 
 static void alloc_data_for_simd(MULTI2_PRIVATE_DATA *prv);
 static void release_data_for_simd(MULTI2_PRIVATE_DATA *prv);
+static void set_work_key_for_instance(MULTI2_PRIVATE_DATA *prv);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  interface method implementation
@@ -182,7 +191,6 @@ static int set_round_multi2(void *m2, int32_t val)
 	}
 
 	prv->round = val;
-	set_round_for_simd(val);
 
 	return 0;
 }
@@ -197,20 +205,19 @@ static int set_simd_multi2(void *m2, enum INSTRUCTION_TYPE instruction)
 	prv = private_data(m2);
 	simd = prv->simd;
 
-	if( instruction == get_simd_instruction() ){
-		if( (simd != NULL) || (instruction == INSTRUCTION_NORMAL) ){
-			return 0;
-		}
+	if( (simd != NULL) && (instruction == simd->instruction) ){
+		return 0;
 	}
 
 	r = (MULTI2 *)(prv+1);
-	if( initialize_multi2_simd(instruction, m2) ){
+	instruction = initialize_multi2_simd(instruction);
+	if( instruction != INSTRUCTION_NORMAL ){
 		r->decrypt = decrypt_with_simd_multi2;
 		if(simd == NULL){
 			alloc_data_for_simd(prv);
 			simd = prv->simd;
 		}
-		instruction = get_simd_instruction();
+		simd->instruction = instruction;
 		if(instruction == INSTRUCTION_AVX2){
 			simd->decrypt = decrypt_multi2_with_avx2;
 		}else if(instruction == INSTRUCTION_SSSE3){
@@ -220,6 +227,7 @@ static int set_simd_multi2(void *m2, enum INSTRUCTION_TYPE instruction)
 		}else{
 			simd->decrypt = decrypt_multi2_without_simd;
 		}
+		set_work_key_for_instance(prv);
 		return 0;
 	}else{
 		r->decrypt = decrypt_multi2;
@@ -287,9 +295,6 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val)
 	uint8_t *p;
 
 	MULTI2_PRIVATE_DATA *prv;
-#ifdef ENABLE_MULTI2_SIMD
-	MULTI2_SIMD_DATA *simd;
-#endif
 
 	prv = private_data(m2);
 	if( (prv == NULL) || (val == NULL) ){
@@ -311,21 +316,10 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val)
 	core_schedule(prv->wrk+0, &(prv->sys), prv->scr+0);
 	core_schedule(prv->wrk+1, &(prv->sys), prv->scr+1);
 
-#ifdef ENABLE_MULTI2_SIMD
-	simd = prv->simd;
-	if(simd != NULL){
-		if(get_simd_instruction() == INSTRUCTION_AVX2){
-			set_work_key_for_avx2(simd->wrk+0, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+0));
-			set_work_key_for_avx2(simd->wrk+1, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+1));
-		}else{
-			set_work_key_for_simd(simd->wrk+0, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+0));
-			set_work_key_for_simd(simd->wrk+1, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+1));
-		}
-	}
-#endif
-
 	prv->state |= MULTI2_STATE_SCRAMBLE_KEY_SET;
 
+	set_work_key_for_instance(prv);
+
 	return 0;
 }
 
@@ -501,6 +495,10 @@ static int decrypt_with_simd_multi2(void *m2, int32_t type, uint8_t *buf, intptr
 		}
 	}
 
+	if(prv->round != MULTI2_SIMD_SCRAMBLE_ROUND){
+		return decrypt_multi2(m2, type, buf, size);
+	}
+
 	simd = prv->simd;
 	if(type == 0x02){
 		prm = (MULTI2_SIMD_SYS_KEY *)(prv->wrk+1);
@@ -515,6 +513,96 @@ static int decrypt_with_simd_multi2(void *m2, int32_t type, uint8_t *buf, intptr
 	return 0;
 }
 
+static int decrypt_to_multi2(void *m2, int32_t type, const uint8_t *src, uint8_t *dst, int32_t size)
+{
+	MULTI2 *r;
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (src == NULL) || (dst == NULL) || (size < 1) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	/* the C kernels only work in place, copy first */
+	if(dst != src){
+		memcpy(dst, src, size);
+	}
+
+	r = (MULTI2 *)m2;
+	return r->decrypt(m2, type, dst, size);
+}
+
+static int decrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count)
+{
+	int i,code;
+
+	MULTI2 *r;
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (ent == NULL) || (count < 0) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	/* no interleaved kernel here, decrypt the payloads one by one */
+	r = (MULTI2 *)m2;
+	for(i=0;i<count;i++){
+		code = r->decrypt(m2, ent[i].type, ent[i].data, ent[i].size);
+		if(code < 0){
+			return code;
+		}
+	}
+
+	return 0;
+}
+
+static const char *get_kernel_name_multi2(void *m2)
+{
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if(prv == NULL){
+		return NULL;
+	}
+
+#ifdef ENABLE_MULTI2_SIMD
+	if(prv->simd != NULL){
+		if(prv->simd->decrypt == decrypt_multi2_with_avx2){
+			return "avx2";
+		}else if(prv->simd->decrypt == decrypt_multi2_with_ssse3){
+			return "ssse3";
+		}else if(prv->simd->decrypt == decrypt_multi2_with_sse2){
+			return "sse2";
+		}
+	}
+#endif
+
+	return "c";
+}
+
+static int encrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count)
+{
+	int i,code;
+
+	MULTI2 *r;
+	MULTI2_PRIVATE_DATA *prv;
+
+	prv = private_data(m2);
+	if( (prv == NULL) || (ent == NULL) || (count < 0) ){
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	r = (MULTI2 *)m2;
+	for(i=0;i<count;i++){
+		code = r->encrypt(m2, ent[i].type, ent[i].data, ent[i].size);
+		if(code < 0){
+			return code;
+		}
+	}
+
+	return 0;
+}
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  private method implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -664,3 +752,23 @@ void release_data_for_simd(MULTI2_PRIVATE_DATA *prv)
 		prv->simd = NULL;
 	}
 }
+
+void set_work_key_for_instance(MULTI2_PRIVATE_DATA *prv)
+{
+#ifdef ENABLE_MULTI2_SIMD
+	MULTI2_SIMD_DATA *simd;
+
+	simd = prv->simd;
+	if( (simd == NULL) || ((prv->state & MULTI2_STATE_SCRAMBLE_KEY_SET) == 0) ){
+		return;
+	}
+
+	if(simd->instruction == INSTRUCTION_AVX2){
+		set_work_key_for_avx2(simd->wrk+0, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+0));
+		set_work_key_for_avx2(simd->wrk+1, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+1));
+	}else{
+		set_work_key_for_simd(simd->wrk+0, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+0));
+		set_work_key_for_simd(simd->wrk+1, (MULTI2_SIMD_SYS_KEY *)(prv->wrk+1));
+	}
+#endif
+}
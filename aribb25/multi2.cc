@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <new>
 
 #include "multi2.h"
@@ -7,13 +9,70 @@
 
 #include "multi2_compat.h"
 #include "multi2_cipher.h"
+#include "multi2_kernel.h"
 
 namespace multi2 {
 
+const kernel kernel_uint32 = MULTI2_KERNEL("uint32", uint32_t);
+#if !defined(ENABLE_MULTI2_DISPATCH)
+const kernel kernel_native = MULTI2_KERNEL(MULTI2_NATIVE_KERNEL_NAME, native_block_type);
+#else
+const kernel kernel_vector = MULTI2_KERNEL("vector", generic::vec<8>);
+#endif
+
+// kernels this CPU can run, the preferred one first
+static size_t supported_kernels(const kernel **list) {
+	size_t n = 0;
+#if defined(ENABLE_MULTI2_DISPATCH)
+	__builtin_cpu_init();
+
+#if defined(ENABLE_MULTI2_AVX512)
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+		list[n++] = &kernel_avx512_zmm;
+	}
+#endif
+	if (__builtin_cpu_supports("avx2")) {
+		list[n++] = &kernel_avx2_ymm2;
+		list[n++] = &kernel_avx2_ymm;
+	}
+	if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) {
+		list[n++] = &kernel_sse41;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		list[n++] = &kernel_sse2;
+	}
+	list[n++] = &kernel_vector;
+#else
+	list[n++] = &kernel_native;
+#endif
+	list[n++] = &kernel_uint32;
+	return n;
+}
+
+static const kernel *select_kernel() {
+	const kernel *list[8];
+	size_t n = supported_kernels(list);
+
+#if defined(ENABLE_MULTI2_AUTOTUNE)
+	return autotune_kernel(list, n);
+#else
+	(void)n;
+	return list[0];
+#endif
+}
+
+// chosen once, the first time an instance is created
+static const kernel *default_kernel() {
+	static const kernel *k = select_kernel();
+	return k;
+}
+
 struct multi2 : public MULTI2 {
 	uint32_t ref_count;
 	uint32_t round;
 
+	const kernel *k;
+
 	optional<system_key_type> system_key;
 	optional<iv_type> iv;
 
@@ -25,7 +84,12 @@ struct multi2 : public MULTI2 {
 		for (size_t i = 0; i < s.size(); ++i) {
 			s[i] = load_be(p + i * 4);
 		}
-		system_key = s;
+		if (!system_key || *system_key != s) {
+			system_key = s;
+			work_key[0].reset();
+			work_key[1].reset();
+		}
+		schedule_work_keys();
 	}
 
 	inline void set_iv(uint8_t *p) {
@@ -48,6 +112,18 @@ struct multi2 : public MULTI2 {
 				work_key[i].reset();
 			}
 		}
+		schedule_work_keys();
+	}
+
+	// done as soon as the keys are known rather than on first use, so
+	// that decrypting only reads the instance and several threads can
+	// decrypt with it at once
+	inline void schedule_work_keys() {
+		for (int i = 0; i < 2; ++i) {
+			if (system_key && data_key[i] && !work_key[i]) {
+				work_key[i] = schedule(*data_key[i], *system_key);
+			}
+		}
 	}
 
 	inline void clear_work_keys() {
@@ -57,9 +133,7 @@ struct multi2 : public MULTI2 {
 		}
 	}
 
-	inline int encrypt(int32_t type, uint8_t *b, size_t n) {
-		int i = (type == 0x02);
-
+	inline int prepare_work_key(int i) {
 		if (!iv) {
 			return MULTI2_ERROR_UNSET_CBC_INIT;
 		}
@@ -73,31 +147,263 @@ struct multi2 : public MULTI2 {
 			}
 			work_key[i] = schedule(*data_key[i], *system_key);
 		}
+		return 0;
+	}
+
+	inline int encrypt(int32_t type, uint8_t *b, size_t n) {
+		int i = (type == 0x02);
+
+		int r = prepare_work_key(i);
+		if (r < 0) {
+			return r;
+		}
 
 		encrypt_cbc_ofb(b, n, *iv, *work_key[i], round);
 		return 0;
 	}
 
 	inline int decrypt(int32_t type, uint8_t *b, size_t n) {
+		return decrypt_to(type, b, b, n);
+	}
+
+	inline int decrypt_to(int32_t type, const uint8_t *src, uint8_t *dst, size_t n) {
 		int i = (type == 0x02);
 
-		if (!iv) {
-			return MULTI2_ERROR_UNSET_CBC_INIT;
+		int r = prepare_work_key(i);
+		if (r < 0) {
+			return r;
 		}
 
-		if (!work_key[i]) {
-			if (!system_key) {
-				return MULTI2_ERROR_UNSET_SYSTEM_KEY;
+		k->decrypt(dst, src, n, &(*iv)[0], &(*work_key[i])[0], round);
+		return 0;
+	}
+
+	// checks every entry and schedules the work keys they need
+	inline int prepare_batch(MULTI2_BATCH_ENTRY *e, int32_t count) {
+		bool used[2] = { false, false };
+		for (int32_t j = 0; j < count; ++j) {
+			if (!e[j].data || e[j].size < 1) {
+				return MULTI2_ERROR_INVALID_PARAMETER;
 			}
-			if (!data_key[i]) {
-				return MULTI2_ERROR_UNSET_SCRAMBLE_KEY;
+			used[e[j].type == 0x02] = true;
+		}
+
+		for (int i = 0; i < 2; ++i) {
+			if (used[i]) {
+				int r = prepare_work_key(i);
+				if (r < 0) {
+					return r;
+				}
 			}
-			work_key[i] = schedule(*data_key[i], *system_key);
+		}
+		return 0;
+	}
+
+	// CBC is serial within a payload, so each payload takes one lane and
+	// step s encrypts block s of every payload in the group with a single
+	// encrypt_ecb() call. The OFB tail is one more step that encrypts the
+	// chaining state alone. 16 fills the widest block types (zmm, ymm2).
+	enum { encrypt_lanes = 16 };
+
+	inline int encrypt_batch(MULTI2_BATCH_ENTRY *e, int32_t count) {
+		int r = prepare_batch(e, count);
+		if (r < 0) {
+			return r;
+		}
+
+		for (int32_t g = 0; g < count; g += encrypt_lanes) {
+			encrypt_group(e + g, std::min<int32_t>(count - g, encrypt_lanes));
+		}
+		return 0;
+	}
+
+	inline void encrypt_group(MULTI2_BATCH_ENTRY *e, int32_t count) {
+		uint8_t state[encrypt_lanes][8];
+		uint8_t in[encrypt_lanes * 8];
+		uint8_t out[encrypt_lanes * 8];
+		uint8_t sel[encrypt_lanes * 8];
+		int32_t lane[encrypt_lanes];
+
+		for (int32_t j = 0; j < count; ++j) {
+			store_be(state[j],     (*iv)[0]);
+			store_be(state[j] + 4, (*iv)[1]);
 		}
 
-		decrypt_cbc_ofb(b, n, *iv, *work_key[i], round);
+		for (size_t s = 0; ; ++s) {
+			size_t n = 0;
+			size_t keyed[2] = { 0, 0 };
+			for (int32_t j = 0; j < count; ++j) {
+				size_t blocks = e[j].size / 8;
+				if (s < blocks) {
+					xor_block(in + n * 8, e[j].data + s * 8, state[j]);
+				} else if (s == blocks && e[j].size % 8) {
+					memcpy(in + n * 8, state[j], 8);
+				} else {
+					continue;
+				}
+
+				int i = (e[j].type == 0x02);
+				memset(sel + n * 8, i ? 0xff : 0x00, 8);
+				keyed[i] += 1;
+				lane[n++] = j;
+			}
+			if (n == 0) {
+				break;
+			}
+
+			if (keyed[1] == 0) {
+				k->encrypt_ecb(out, in, n, &(*work_key[0])[0], round);
+			} else if (keyed[0] == 0) {
+				k->encrypt_ecb(out, in, n, &(*work_key[1])[0], round);
+			} else {
+				k->encrypt_ecb_mixed(out, in, sel, n, &(*work_key[0])[0], &(*work_key[1])[0], round);
+			}
+
+			for (size_t m = 0; m < n; ++m) {
+				MULTI2_BATCH_ENTRY &x = e[lane[m]];
+				size_t blocks = x.size / 8;
+				if (s < blocks) {
+					memcpy(x.data + s * 8, out + m * 8, 8);
+					memcpy(state[lane[m]], out + m * 8, 8);
+				} else {
+					for (size_t b = 0; b < static_cast<size_t>(x.size % 8); ++b) {
+						x.data[blocks * 8 + b] ^= out[m * 8 + b];
+					}
+				}
+			}
+		}
+	}
+
+	inline int decrypt_batch(MULTI2_BATCH_ENTRY *e, int32_t count) {
+		int r = prepare_batch(e, count);
+		if (r < 0) {
+			return r;
+		}
+
+		batch_chunk c;
+		c.used = c.runs = 0;
+		c.keyed[0] = c.keyed[1] = 0;
+
+		uint8_t v[8];
+		store_be(v,     (*iv)[0]);
+		store_be(v + 4, (*iv)[1]);
+
+		for (int32_t j = 0; j < count; ++j) {
+			int i = (e[j].type == 0x02);
+
+			uint8_t *p = e[j].data;
+			size_t blocks = e[j].size / 8;
+			size_t rest   = e[j].size % 8;
+
+			// the OFB tail needs the last ciphertext block, so do it before
+			// the whole blocks are overwritten
+			if (0 < rest) {
+				cbc_state state((*iv)[0], (*iv)[1]);
+				if (0 < blocks) {
+					state.load(p + (blocks - 1) * 8);
+				}
+
+				uint8_t t[8];
+				cipher<uint32_t>::encrypt(state, *work_key[i], round).store(t);
+				for (size_t m = 0; m < rest; ++m) {
+					p[blocks * 8 + m] ^= t[m];
+				}
+			}
+
+			const uint8_t *prev = v;
+			uint8_t carry[8];
+			while (0 < blocks) {
+				if (c.used == batch_chunk_blocks) {
+					flush_batch(c);
+				}
+
+				size_t m = std::min<size_t>(blocks, batch_chunk_blocks - c.used);
+				batch_run &r = c.run[c.runs++];
+				r.dst    = p;
+				r.blocks = m;
+				r.key    = i;
+				memcpy(r.prev, prev, 8);
+
+				memcpy(c.ct + c.used * 8, p, m * 8);
+				c.used     += m;
+				c.keyed[i] += m;
+
+				// ciphertext in front of the next run, before this one is written back
+				memcpy(carry, p + (m - 1) * 8, 8);
+				prev = carry;
+
+				p      += m * 8;
+				blocks -= m;
+			}
+		}
+
+		if (0 < c.used) {
+			flush_batch(c);
+		}
 		return 0;
 	}
+
+	// Whole blocks of every payload are packed back to back into a chunk and
+	// decrypted with decrypt_ecb(), so lanes stay full across payload
+	// boundaries. A chunk holding both parities goes through
+	// decrypt_ecb_mixed() instead of being split at each parity change.
+	// The CBC XOR with the preceding ciphertext (or the IV) is applied when
+	// the chunk is written back.
+	struct batch_run {
+		uint8_t *dst;
+		size_t   blocks;
+		int      key;
+		uint8_t  prev[8];
+	};
+
+	enum { batch_chunk_blocks = 240 };
+
+	struct batch_chunk {
+		uint8_t   ct[batch_chunk_blocks * 8];
+		uint8_t   pt[batch_chunk_blocks * 8];
+		uint8_t   sel[batch_chunk_blocks * 8];
+		batch_run run[batch_chunk_blocks];
+		size_t    used;
+		size_t    runs;
+		size_t    keyed[2];
+	};
+
+	static inline void xor_block(uint8_t *dst, const uint8_t *a, const uint8_t *b) {
+		uint64_t x, y;
+		memcpy(&x, a, 8);
+		memcpy(&y, b, 8);
+		x ^= y;
+		memcpy(dst, &x, 8);
+	}
+
+	inline void flush_batch(batch_chunk &c) {
+		if (c.keyed[1] == 0) {
+			k->decrypt_ecb(c.pt, c.ct, c.used, &(*work_key[0])[0], round);
+		} else if (c.keyed[0] == 0) {
+			k->decrypt_ecb(c.pt, c.ct, c.used, &(*work_key[1])[0], round);
+		} else {
+			uint8_t *s = c.sel;
+			for (size_t r = 0; r < c.runs; ++r) {
+				memset(s, c.run[r].key ? 0xff : 0x00, c.run[r].blocks * 8);
+				s += c.run[r].blocks * 8;
+			}
+			k->decrypt_ecb_mixed(c.pt, c.ct, c.sel, c.used, &(*work_key[0])[0], &(*work_key[1])[0], round);
+		}
+
+		const uint8_t *d = c.pt;
+		const uint8_t *e = c.ct;
+		for (size_t r = 0; r < c.runs; ++r) {
+			xor_block(c.run[r].dst, d, c.run[r].prev);
+			for (size_t b = 1; b < c.run[r].blocks; ++b) {
+				xor_block(c.run[r].dst + b * 8, d + b * 8, e + (b - 1) * 8);
+			}
+			d += c.run[r].blocks * 8;
+			e += c.run[r].blocks * 8;
+		}
+
+		c.used = c.runs = 0;
+		c.keyed[0] = c.keyed[1] = 0;
+	}
 };
 
 }
@@ -114,6 +420,10 @@ static int set_scramble_key_multi2(void *m2, uint8_t *val);
 static int clear_scramble_key_multi2(void *m2);
 static int encrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
 static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size);
+static int decrypt_to_multi2(void *m2, int32_t type, const uint8_t *src, uint8_t *dst, int32_t size);
+static int decrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
+static const char *get_kernel_name_multi2(void *m2);
+static int encrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
@@ -129,6 +439,7 @@ MULTI2 *create_multi2()
 
 	m2->ref_count = 1;
 	m2->round     = 4;
+	m2->k         = multi2::default_kernel();
 
 	MULTI2 *r = static_cast<MULTI2 *>(m2);
 	r->private_data = m2;
@@ -142,6 +453,10 @@ MULTI2 *create_multi2()
 	r->clear_scramble_key = clear_scramble_key_multi2;
 	r->encrypt            = encrypt_multi2;
 	r->decrypt            = decrypt_multi2;
+	r->decrypt_to         = decrypt_to_multi2;
+	r->decrypt_batch      = decrypt_batch_multi2;
+	r->get_kernel_name    = get_kernel_name_multi2;
+	r->encrypt_batch      = encrypt_batch_multi2;
 
 	return r;
 }
@@ -253,6 +568,46 @@ static int decrypt_multi2(void *m2, int32_t type, uint8_t *buf, int32_t size)
 	return prv->decrypt(type, buf, size);
 }
 
+static int decrypt_to_multi2(void *m2, int32_t type, const uint8_t *src, uint8_t *dst, int32_t size)
+{
+	multi2::multi2 *prv = private_data(m2);
+	if (!prv || !src || !dst || size < 1) {
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->decrypt_to(type, src, dst, size);
+}
+
+static int decrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count)
+{
+	multi2::multi2 *prv = private_data(m2);
+	if (!prv || !ent || count < 0) {
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->decrypt_batch(ent, count);
+}
+
+static const char *get_kernel_name_multi2(void *m2)
+{
+	multi2::multi2 *prv = private_data(m2);
+	if (!prv) {
+		return NULL;
+	}
+
+	return prv->k->name;
+}
+
+static int encrypt_batch_multi2(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count)
+{
+	multi2::multi2 *prv = private_data(m2);
+	if (!prv || !ent || count < 0) {
+		return MULTI2_ERROR_INVALID_PARAMETER;
+	}
+
+	return prv->encrypt_batch(ent, count);
+}
+
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  private method implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -4,6 +4,12 @@
 #include "portable.h"
 #include "simd_instruction_type.h"
 
+typedef struct {
+	uint8_t *data;
+	int32_t  size;
+	int32_t  type;  /* transport_scrambling_control: 0x02 (even) or 0x03 (odd) */
+} MULTI2_BATCH_ENTRY;
+
 typedef struct {
 
 	void *private_data;
@@ -20,12 +26,26 @@ typedef struct {
 	int (* clear_scramble_key)(void *m2);
 
 	int (* encrypt)(void *m2, int32_t type, uint8_t *buf, int32_t size);
+
+	/* once the keys are set, the decrypt calls only read the instance
+	   and may run on several threads at once */
 #ifdef ENABLE_MULTI2_SIMD
 	int (* decrypt)(void *m2, int32_t type, uint8_t *buf, intptr_t size);
 #else
 	int (* decrypt)(void *m2, int32_t type, uint8_t *buf, int32_t size);
 #endif
 
+	/* src and dst are either the same buffer or do not overlap */
+	int (* decrypt_to)(void *m2, int32_t type, const uint8_t *src, uint8_t *dst, int32_t size);
+
+	int (* decrypt_batch)(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
+
+	/* name of the code path that decrypts for this instance, e.g. "avx2-ymm2" */
+	const char *(* get_kernel_name)(void *m2);
+
+	/* encrypts every entry, as encrypt() would one by one */
+	int (* encrypt_batch)(void *m2, MULTI2_BATCH_ENTRY *ent, int32_t count);
+
 } MULTI2;
 
 #ifdef __cplusplus
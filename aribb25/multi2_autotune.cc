@@ -0,0 +1,196 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <unistd.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+# include <cpuid.h>
+#endif
+
+#include "multi2_kernel.h"
+
+namespace multi2 {
+
+static double now() {
+#if defined(_WIN32)
+	LARGE_INTEGER c, f;
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	return static_cast<double>(c.QuadPart) / static_cast<double>(f.QuadPart);
+#else
+	struct timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec * 1e-6;
+#endif
+}
+
+// a cache written on another machine (shared home directory) must not be trusted
+static std::string cpu_signature() {
+	std::string s;
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int r[12];
+	if (__get_cpuid(0x80000000, &r[0], &r[1], &r[2], &r[3]) && r[0] >= 0x80000004) {
+		for (unsigned int i = 0; i < 3; ++i) {
+			__get_cpuid(0x80000002 + i, &r[i * 4], &r[i * 4 + 1], &r[i * 4 + 2], &r[i * 4 + 3]);
+		}
+		s.assign(reinterpret_cast<const char *>(r), sizeof(r));
+		s.erase(s.find_last_not_of(std::string(" \0", 2)) + 1);
+		s.erase(0, s.find_first_not_of(' '));
+	}
+#endif
+	if (s.empty()) {
+		s = "unknown";
+	}
+	return s;
+}
+
+// $XDG_CACHE_HOME/libaribb25/multi2-kernel, or an empty string when there is
+// nowhere to keep it
+static std::string cache_path(bool create) {
+#if defined(_WIN32)
+	(void)create;
+	return std::string();
+#else
+	std::string dir;
+	const char *xdg = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (xdg && xdg[0] == '/') {
+		dir = xdg;
+	} else if (home && home[0]) {
+		dir = std::string(home) + "/.cache";
+	} else {
+		return std::string();
+	}
+
+	if (create) {
+		mkdir(dir.c_str(), 0700);
+	}
+	dir += "/libaribb25";
+	if (create) {
+		mkdir(dir.c_str(), 0700);
+	}
+	return dir + "/multi2-kernel";
+#endif
+}
+
+static const kernel *read_cache(const std::string &sig, const kernel *const *candidates, size_t count) {
+	std::string path = cache_path(false);
+	if (path.empty()) {
+		return NULL;
+	}
+
+	FILE *fp = fopen(path.c_str(), "r");
+	if (!fp) {
+		return NULL;
+	}
+
+	char line[2][256];
+	bool ok = fgets(line[0], sizeof(line[0]), fp) && fgets(line[1], sizeof(line[1]), fp);
+	fclose(fp);
+	if (!ok) {
+		return NULL;
+	}
+	for (int i = 0; i < 2; ++i) {
+		line[i][strcspn(line[i], "\r\n")] = '\0';
+	}
+
+	if (sig != line[0]) {
+		return NULL;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (!strcmp(candidates[i]->name, line[1])) {
+			return candidates[i];
+		}
+	}
+	return NULL;
+}
+
+static void write_cache(const std::string &sig, const kernel *k) {
+	std::string path = cache_path(true);
+	if (path.empty()) {
+		return;
+	}
+
+	// write to a private name first so concurrent starts never read half a file
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%ld", static_cast<long>(getpid()));
+	std::string tmp = path + suffix;
+
+	FILE *fp = fopen(tmp.c_str(), "w");
+	if (!fp) {
+		return;
+	}
+	bool ok = fprintf(fp, "%s\n%s\n", sig.c_str(), k->name) > 0;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+		remove(tmp.c_str());
+	}
+}
+
+// seconds for one pass over a batch of synthetic 184-byte payloads, the size
+// of a TS packet payload without an adaptation field; best of a few runs
+static double measure(const kernel *k) {
+	enum { payload = 184, payloads = 64, passes = 4, runs = 5 };
+
+	static uint8_t buf[payload * payloads];
+	for (size_t i = 0; i < sizeof(buf); ++i) {
+		buf[i] = static_cast<uint8_t>(i * 131 + 7);
+	}
+	const uint32_t iv[2] = { 0xfe27199a, 0x69fc1c3a };
+	const uint32_t wk[8] = {
+		0x1b4f2c6a, 0x0a8d1f73, 0x45e0b291, 0x9c3d7e08,
+		0x6f12a4d5, 0xd3806b2e, 0x27c9f561, 0x8e5a03bc,
+	};
+
+	double best = 0;
+	for (int r = 0; r < runs; ++r) {
+		double t0 = now();
+		for (int p = 0; p < passes; ++p) {
+			for (int i = 0; i < payloads; ++i) {
+				uint8_t *b = buf + i * payload;
+				k->decrypt(b, b, payload, iv, wk, 4);
+			}
+		}
+		double t = now() - t0;
+		if (r == 0 || t < best) {
+			best = t;
+		}
+	}
+	return best;
+}
+
+const kernel *autotune_kernel(const kernel *const *candidates, size_t count) {
+	if (count < 2) {
+		return candidates[0];
+	}
+
+	std::string sig = cpu_signature();
+
+	const kernel *k = read_cache(sig, candidates, count);
+	if (k) {
+		return k;
+	}
+
+	k = candidates[0];
+	double best = measure(k);
+	for (size_t i = 1; i < count; ++i) {
+		double t = measure(candidates[i]);
+		if (t < best) {
+			best = t;
+			k = candidates[i];
+		}
+	}
+
+	write_cache(sig, k);
+	return k;
+}
+
+}
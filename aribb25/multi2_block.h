@@ -4,7 +4,9 @@
 
 #include "portable.h"
 
-namespace multi2 {
+#include "multi2_compat.h"
+
+namespace MULTI2_NAMESPACE {
 
 inline uint32_t load_be(const uint8_t *p) {
 	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
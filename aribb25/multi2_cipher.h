@@ -5,11 +5,13 @@
 #include "portable.h"
 
 #include "multi2_block.h"
+#include "multi2_zmm.h"
 #include "multi2_ymm2.h"
 #include "multi2_ymm.h"
 #include "multi2_xmm.h"
 #include "multi2_neon2.h"
 #include "multi2_neon.h"
+#include "multi2_vec.h"
 
 #if defined(__GNUC__) || defined(__clang__)
 # define MULTI2_ALWAYS_INLINE __attribute__((always_inline))
@@ -19,7 +21,7 @@
 # define MULTI2_LIKELY(x)     (x)
 #endif
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 typedef array<uint32_t, 8> system_key_type;
 typedef array<uint32_t, 2> iv_type;
@@ -34,14 +36,17 @@ struct pi {
 		return block_type(p.left, p.right ^ p.left);
 	}
 
-	static inline block_type pi2(const block_type &p, uint32_t k1) {
+	// K is uint32_t for a key shared by all lanes, or T for a key per lane
+	template<typename K>
+	static inline block_type pi2(const block_type &p, const K &k1) {
 		T x = p.right;
 		T y = x + T(k1);
 		T z = rot1_add_dec(y);
 		return block_type(p.left ^ rot<4>(z) ^ z, p.right);
 	}
 
-	static inline block_type pi3(const block_type &p, uint32_t k2, uint32_t k3) {
+	template<typename K>
+	static inline block_type pi3(const block_type &p, const K &k2, const K &k3) {
 		T x = p.left;
 		T y = x + T(k2);
 		T z = rot<2>(y) + y + T(1);
@@ -51,49 +56,113 @@ struct pi {
 		return block_type(p.left, p.right ^ rot<16>(c) ^ (c | x));
 	}
 
-	static inline block_type pi4(const block_type &p, uint32_t k4) {
+	template<typename K>
+	static inline block_type pi4(const block_type &p, const K &k4) {
 		T x = p.right;
 		T y = x + T(k4);
 		return block_type(p.left ^ (rot<2>(y) + y + T(1)), p.right);
 	}
 };
 
+// Round count fixed at compile time. The cipher unrolls every round for
+// it, so the work keys can stay in registers across round boundaries.
+template<int N>
+struct fixed_round {
+	inline operator int() const { return N; }
+};
+
+// whether fixed_round<N> unrolls the rounds for block type T
+template<typename T>
+struct unroll_rounds {
+	enum { value = 1 };
+};
+
+#if defined(__AVX2__)
+// two ymm registers per half block leave no room for the unrolled rounds
+template<>
+struct unroll_rounds<x86::ymm2> {
+	enum { value = 0 };
+};
+#endif
+
 template<typename T>
 struct cipher {
 	typedef block<T> block_type;
 	typedef pi<T> p;
 
-	static inline block_type encrypt(const block_type &b, const work_key_type &wk, int n) {
+	template<typename W>
+	static inline block_type encrypt_round(const block_type &b, const W &wk) {
+		block_type t = b;
+		t = p::pi1(t);
+		t = p::pi2(t, wk[0]);
+		t = p::pi3(t, wk[1], wk[2]);
+		t = p::pi4(t, wk[3]);
+		t = p::pi1(t);
+		t = p::pi2(t, wk[4]);
+		t = p::pi3(t, wk[5], wk[6]);
+		t = p::pi4(t, wk[7]);
+		return t;
+	}
+
+	template<typename W>
+	static inline block_type decrypt_round(const block_type &b, const W &wk) {
+		block_type t = b;
+		t = p::pi4(t, wk[7]);
+		t = p::pi3(t, wk[5], wk[6]);
+		t = p::pi2(t, wk[4]);
+		t = p::pi1(t);
+		t = p::pi4(t, wk[3]);
+		t = p::pi3(t, wk[1], wk[2]);
+		t = p::pi2(t, wk[0]);
+		t = p::pi1(t);
+		return t;
+	}
+
+	template<typename W>
+	static inline block_type encrypt(const block_type &b, const W &wk, int n) {
 		block_type t = b;
 
 		for (int i = 0; i < n; ++i) {
-			t = p::pi1(t);
-			t = p::pi2(t, wk[0]);
-			t = p::pi3(t, wk[1], wk[2]);
-			t = p::pi4(t, wk[3]);
-			t = p::pi1(t);
-			t = p::pi2(t, wk[4]);
-			t = p::pi3(t, wk[5], wk[6]);
-			t = p::pi4(t, wk[7]);
+			t = encrypt_round(t, wk);
 		}
 		return t;
 	}
 
-	static inline block_type decrypt(const block_type &b, const work_key_type &wk, int n) {
+	template<typename W>
+	static inline block_type decrypt(const block_type &b, const W &wk, int n) {
 		block_type t = b;
 
 		for (int i = 0; i < n; ++i) {
-			t = p::pi4(t, wk[7]);
-			t = p::pi3(t, wk[5], wk[6]);
-			t = p::pi2(t, wk[4]);
-			t = p::pi1(t);
-			t = p::pi4(t, wk[3]);
-			t = p::pi3(t, wk[1], wk[2]);
-			t = p::pi2(t, wk[0]);
-			t = p::pi1(t);
+			t = decrypt_round(t, wk);
 		}
 		return t;
 	}
+
+	template<typename W, int N>
+	static inline block_type encrypt(const block_type &b, const W &wk, fixed_round<N>) {
+		if (!unroll_rounds<T>::value) {
+			return encrypt(b, wk, static_cast<int>(N));
+		}
+		return encrypt(encrypt_round(b, wk), wk, fixed_round<N - 1>());
+	}
+
+	template<typename W>
+	static inline block_type encrypt(const block_type &b, const W &, fixed_round<0>) {
+		return b;
+	}
+
+	template<typename W, int N>
+	static inline block_type decrypt(const block_type &b, const W &wk, fixed_round<N>) {
+		if (!unroll_rounds<T>::value) {
+			return decrypt(b, wk, static_cast<int>(N));
+		}
+		return decrypt(decrypt_round(b, wk), wk, fixed_round<N - 1>());
+	}
+
+	template<typename W>
+	static inline block_type decrypt(const block_type &b, const W &, fixed_round<0>) {
+		return b;
+	}
 };
 
 
@@ -152,70 +221,370 @@ inline void encrypt_cbc_ofb(uint8_t *buf, size_t n, const iv_type &iv, const wor
 	}
 }
 
-template<typename T>
+template<typename T, typename R>
 MULTI2_ALWAYS_INLINE
-static inline void decrypt_block(uint8_t *&buf, size_t &n, cbc_state &state, const work_key_type &key, int round) {
+static inline void decrypt_block(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
 	block<T> c;
-	c.load(buf);
+	c.load(src);
 
 	block<T> d = cipher<T>::decrypt(c, key, round);
 	std::pair<block<T>, cbc_state> ps = d.cbc_post_decrypt(c, state);
-	ps.first.store(buf);
+	ps.first.store(dst);
 
 	state = ps.second;
-	buf += block_size<T>();
+	src += block_size<T>();
+	dst += block_size<T>();
 	n   -= block_size<T>();
 }
 
-inline void decrypt_cbc_ofb(uint8_t *buf, size_t n, const iv_type &iv, const work_key_type &key, int round) {
+template<typename T>
+struct decrypt_path {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		while (block_size<T>() <= n) {
+			decrypt_block<T>(src, dst, n, state, key, round);
+		}
+	}
+};
 
-	cbc_state state(iv[0], iv[1]);
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+template<>
+struct decrypt_path<x86::zmm> {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		while (block_size<x86::zmm>() <= n) {
+			decrypt_block<x86::zmm>(src, dst, n, state, key, round);
+		}
+		if (block_size<uint32_t>() <= n) {
+			// remaining whole blocks go through one masked pass, e.g. 7 of the 23 in a 184-byte payload
+			size_t k = n / block_size<uint32_t>();
+
+			block<x86::zmm> c;
+			x86::zmm::load_block_partial(c, src, k);
+
+			block<x86::zmm> d = cipher<x86::zmm>::decrypt(c, key, round);
+			std::pair<block<x86::zmm>, cbc_state> ps = x86::zmm::cbc_post_decrypt(d, c, state, k);
+			x86::zmm::store_block_partial(dst, ps.first, k);
+
+			state = ps.second;
+			src += k * block_size<uint32_t>();
+			dst += k * block_size<uint32_t>();
+			n   -= k * block_size<uint32_t>();
+		}
+	}
+};
+#endif
 
 #if defined(__AVX2__)
-	if (MULTI2_LIKELY(n == 184)) {
-		decrypt_block<x86::ymm2>(buf, n, state, key, round);
-		decrypt_block<x86::ymm>(buf, n, state, key, round);
-		return;
+template<>
+struct decrypt_path<x86::ymm2> {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		if (MULTI2_LIKELY(n == 184)) {
+			decrypt_block<x86::ymm2>(src, dst, n, state, key, round);
+			decrypt_block<x86::ymm>(src, dst, n, state, key, round);
+			return;
+		}
+		if (block_size<x86::ymm2>() <= n) {
+			decrypt_block<x86::ymm2>(src, dst, n, state, key, round);
+		}
+		if (block_size<x86::ymm>() <= n) {
+			decrypt_block<x86::ymm>(src, dst, n, state, key, round);
+		}
+		if (block_size<x86::xmm>() <= n) {
+			decrypt_block<x86::xmm>(src, dst, n, state, key, round);
+		}
 	}
-	if (block_size<x86::ymm2>() <= n) {
-		decrypt_block<x86::ymm2>(buf, n, state, key, round);
+};
+
+template<>
+struct decrypt_path<x86::ymm> {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		while (block_size<x86::ymm>() <= n) {
+			decrypt_block<x86::ymm>(src, dst, n, state, key, round);
+		}
+		if (block_size<x86::xmm>() <= n) {
+			decrypt_block<x86::xmm>(src, dst, n, state, key, round);
+		}
 	}
-	if (block_size<x86::ymm>() <= n) {
-		decrypt_block<x86::ymm>(buf, n, state, key, round);
+};
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+template<>
+struct decrypt_path<arm::neon2<8> > {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		if (MULTI2_LIKELY(n == 184)) {
+			decrypt_block<arm::neon2<7> >(src, dst, n, state, key, round);
+			decrypt_block<arm::neon2<8> >(src, dst, n, state, key, round);
+			decrypt_block<arm::neon2<8> >(src, dst, n, state, key, round);
+			return;
+		}
+		while (block_size<arm::neon2<8> >() <= n) {
+			decrypt_block<arm::neon2<8> >(src, dst, n, state, key, round);
+		}
+		if (block_size<arm::neon>() <= n) {
+			decrypt_block<arm::neon>(src, dst, n, state, key, round);
+		}
 	}
-#if defined(__SSE2__)
-	if (block_size<x86::xmm>() <= n) {
-		decrypt_block<x86::xmm>(buf, n, state, key, round);
+};
+#endif
+
+#if defined(__GNUC__)
+template<>
+struct decrypt_path<generic::vec<8> > {
+	template<typename R>
+	static inline void run(const uint8_t *&src, uint8_t *&dst, size_t &n, cbc_state &state, const work_key_type &key, R round) {
+		while (block_size<generic::vec<8> >() <= n) {
+			decrypt_block<generic::vec<8> >(src, dst, n, state, key, round);
+		}
+		if (block_size<generic::vec<4> >() <= n) {
+			decrypt_block<generic::vec<4> >(src, dst, n, state, key, round);
+		}
 	}
+};
+#endif
+
+// vector registers the compiler can target through vector extensions alone
+#if defined(__GNUC__) && (defined(__ALTIVEC__) || defined(__VX__) || defined(__riscv_vector) || defined(__loongarch_sx))
+# define MULTI2_VECTOR_NATIVE
 #endif
 
+// widest block type enabled by the compiler flags of this translation unit
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+typedef x86::zmm native_block_type;
+# define MULTI2_NATIVE_KERNEL_NAME "avx512-zmm"
+#elif defined(__AVX2__)
+typedef x86::ymm2 native_block_type;
+# define MULTI2_NATIVE_KERNEL_NAME "avx2-ymm2"
 #elif defined(__SSE2__)
-	while (block_size<x86::xmm>() <= n) {
-		decrypt_block<x86::xmm>(buf, n, state, key, round);
+typedef x86::xmm native_block_type;
+# if defined(__SSE4_1__)
+#  define MULTI2_NATIVE_KERNEL_NAME "sse4.1"
+# else
+#  define MULTI2_NATIVE_KERNEL_NAME "sse2"
+# endif
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+typedef arm::neon2<8> native_block_type;
+# define MULTI2_NATIVE_KERNEL_NAME "neon"
+#elif defined(MULTI2_VECTOR_NATIVE)
+typedef generic::vec<8> native_block_type;
+# define MULTI2_NATIVE_KERNEL_NAME "vector"
+#else
+typedef uint32_t native_block_type;
+# define MULTI2_NATIVE_KERNEL_NAME "uint32"
+#endif
+
+// block type that takes over once fewer than block_size<T>() bytes are left
+template<typename T>
+struct narrower {
+	typedef uint32_t type;
+};
+
+#if defined(__AVX2__)
+template<>
+struct narrower<x86::ymm2> {
+	typedef x86::ymm type;
+};
+
+template<>
+struct narrower<x86::ymm> {
+	typedef x86::xmm type;
+};
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+template<>
+struct narrower<arm::neon2<8> > {
+	typedef arm::neon type;
+};
+#endif
+
+#if defined(__GNUC__)
+template<>
+struct narrower<generic::vec<8> > {
+	typedef generic::vec<4> type;
+};
+#endif
+
+// Per-lane work key for one block of lanes: m holds all ones in the lanes
+// that use k1 and zero in the lanes that use k0.
+template<typename T>
+inline array<T, 8> select_work_key(const T &m, const work_key_type &k0, const work_key_type &k1) {
+	array<T, 8> k;
+	for (size_t i = 0; i < 8; ++i) {
+		k[i] = T(k0[i]) ^ (m & T(k0[i] ^ k1[i]));
 	}
+	return k;
+}
 
-#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
-	if (MULTI2_LIKELY(n == 184)) {
-		decrypt_block<arm::neon2<7> >(buf, n, state, key, round);
-		decrypt_block<arm::neon2<8> >(buf, n, state, key, round);
-		decrypt_block<arm::neon2<8> >(buf, n, state, key, round);
-		return;
+// direction of an ecb_path pass
+struct ecb_decrypt {
+	template<typename T, typename W, typename R>
+	static inline block<T> run(const block<T> &b, const W &wk, R round) {
+		return cipher<T>::decrypt(b, wk, round);
 	}
-	while (block_size<arm::neon2<8> >() <= n) {
-		decrypt_block<arm::neon2<8> >(buf, n, state, key, round);
+};
+
+struct ecb_encrypt {
+	template<typename T, typename W, typename R>
+	static inline block<T> run(const block<T> &b, const W &wk, R round) {
+		return cipher<T>::encrypt(b, wk, round);
 	}
-	if (block_size<arm::neon>() <= n) {
-		decrypt_block<arm::neon>(buf, n, state, key, round);
+};
+
+// Runs independent blocks (no chaining) from src to dst through D, n is a
+// multiple of 8. run_mixed() picks the key of each block from sel, which
+// has 8 bytes per block: 0x00 for k0 or 0xff for k1.
+template<typename T>
+struct ecb_path {
+	typedef typename narrower<T>::type next_type;
+
+	template<typename D, typename R>
+	static inline void run(uint8_t *dst, const uint8_t *src, size_t n, const work_key_type &key, R round) {
+		while (block_size<T>() <= n) {
+			block<T> c;
+			c.load(src);
+			D::run(c, key, round).store(dst);
+
+			src += block_size<T>();
+			dst += block_size<T>();
+			n   -= block_size<T>();
+		}
+		ecb_path<next_type>::template run<D>(dst, src, n, key, round);
 	}
 
+	template<typename D, typename R>
+	static inline void run_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t n, const work_key_type &k0, const work_key_type &k1, R round) {
+		while (block_size<T>() <= n) {
+			block<T> c, m;
+			c.load(src);
+			m.load(sel);
+			D::run(c, select_work_key(m.left, k0, k1), round).store(dst);
+
+			src += block_size<T>();
+			sel += block_size<T>();
+			dst += block_size<T>();
+			n   -= block_size<T>();
+		}
+		ecb_path<next_type>::template run_mixed<D>(dst, src, sel, n, k0, k1, round);
+	}
+};
+
+template<>
+struct ecb_path<uint32_t> {
+	template<typename D, typename R>
+	static inline void run(uint8_t *dst, const uint8_t *src, size_t n, const work_key_type &key, R round) {
+		while (block_size<uint32_t>() <= n) {
+			block<uint32_t> c;
+			c.load(src);
+			D::run(c, key, round).store(dst);
+
+			src += block_size<uint32_t>();
+			dst += block_size<uint32_t>();
+			n   -= block_size<uint32_t>();
+		}
+	}
+
+	template<typename D, typename R>
+	static inline void run_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t n, const work_key_type &k0, const work_key_type &k1, R round) {
+		while (block_size<uint32_t>() <= n) {
+			block<uint32_t> c;
+			c.load(src);
+			D::run(c, sel[0] ? k1 : k0, round).store(dst);
+
+			src += block_size<uint32_t>();
+			sel += block_size<uint32_t>();
+			dst += block_size<uint32_t>();
+			n   -= block_size<uint32_t>();
+		}
+	}
+};
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+template<>
+struct ecb_path<x86::zmm> {
+	template<typename D, typename R>
+	static inline void run(uint8_t *dst, const uint8_t *src, size_t n, const work_key_type &key, R round) {
+		while (block_size<x86::zmm>() <= n) {
+			block<x86::zmm> c;
+			c.load(src);
+			D::run(c, key, round).store(dst);
+
+			src += block_size<x86::zmm>();
+			dst += block_size<x86::zmm>();
+			n   -= block_size<x86::zmm>();
+		}
+		if (block_size<uint32_t>() <= n) {
+			size_t k = n / block_size<uint32_t>();
+
+			block<x86::zmm> c;
+			x86::zmm::load_block_partial(c, src, k);
+			x86::zmm::store_block_partial(dst, D::run(c, key, round), k);
+		}
+	}
+
+	template<typename D, typename R>
+	static inline void run_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t n, const work_key_type &k0, const work_key_type &k1, R round) {
+		while (block_size<x86::zmm>() <= n) {
+			block<x86::zmm> c, m;
+			c.load(src);
+			m.load(sel);
+			D::run(c, select_work_key(m.left, k0, k1), round).store(dst);
+
+			src += block_size<x86::zmm>();
+			sel += block_size<x86::zmm>();
+			dst += block_size<x86::zmm>();
+			n   -= block_size<x86::zmm>();
+		}
+		if (block_size<uint32_t>() <= n) {
+			size_t k = n / block_size<uint32_t>();
+
+			block<x86::zmm> c, m;
+			x86::zmm::load_block_partial(c, src, k);
+			x86::zmm::load_block_partial(m, sel, k);
+			x86::zmm::store_block_partial(dst, D::run(c, select_work_key(m.left, k0, k1), round), k);
+		}
+	}
+};
 #endif
 
+template<typename T, typename R>
+inline void decrypt_ecb(uint8_t *dst, const uint8_t *src, size_t n, const work_key_type &key, R round) {
+	ecb_path<T>::template run<ecb_decrypt>(dst, src, n, key, round);
+}
+
+template<typename T, typename R>
+inline void decrypt_ecb_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t n, const work_key_type &k0, const work_key_type &k1, R round) {
+	ecb_path<T>::template run_mixed<ecb_decrypt>(dst, src, sel, n, k0, k1, round);
+}
+
+template<typename T, typename R>
+inline void encrypt_ecb(uint8_t *dst, const uint8_t *src, size_t n, const work_key_type &key, R round) {
+	ecb_path<T>::template run<ecb_encrypt>(dst, src, n, key, round);
+}
+
+template<typename T, typename R>
+inline void encrypt_ecb_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t n, const work_key_type &k0, const work_key_type &k1, R round) {
+	ecb_path<T>::template run_mixed<ecb_encrypt>(dst, src, sel, n, k0, k1, round);
+}
+
+// dst may be the same buffer as src, but must not overlap it otherwise
+template<typename T, typename R>
+inline void decrypt_cbc_ofb(uint8_t *dst, const uint8_t *src, size_t n, const iv_type &iv, const work_key_type &key, R round) {
+
+	cbc_state state(iv[0], iv[1]);
+
+	decrypt_path<T>::run(src, dst, n, state, key, round);
+
 	while (block_size<uint32_t>() <= n) {
-		decrypt_block<uint32_t>(buf, n, state, key, round);
+		decrypt_block<uint32_t>(src, dst, n, state, key, round);
 	}
 	if (0 < n) {
 		array<uint8_t, 8> t;
-		memcpy(&t[0], buf, n);
+		memcpy(&t[0], src, n);
 		memset(&t[n], 0,   8 - n);
 
 		block<uint32_t> c;
@@ -223,10 +592,19 @@ inline void decrypt_cbc_ofb(uint8_t *buf, size_t n, const iv_type &iv, const wor
 
 		block<uint32_t> p = c ^ cipher<uint32_t>::encrypt(state, key, round);
 		p.store(&t[0]);
-		memcpy(buf, &t[0], n);
+		memcpy(dst, &t[0], n);
 	}
 }
 
+template<typename T>
+inline void decrypt_cbc_ofb(uint8_t *buf, size_t n, const iv_type &iv, const work_key_type &key, int round) {
+	decrypt_cbc_ofb<T>(buf, buf, n, iv, key, round);
+}
+
+inline void decrypt_cbc_ofb(uint8_t *buf, size_t n, const iv_type &iv, const work_key_type &key, int round) {
+	decrypt_cbc_ofb<native_block_type>(buf, n, iv, key, round);
+}
+
 }
 
 #undef MULTI2_ALWAYS_INLINE
@@ -2,7 +2,14 @@
 
 #include <algorithm>
 
-namespace multi2 {
+// Kernels built with their own instruction set flags (see multi2_kernel.h)
+// define MULTI2_NAMESPACE before including the multi2 headers, so that their
+// inline code is never merged with the copies built for another kernel.
+#if !defined(MULTI2_NAMESPACE)
+# define MULTI2_NAMESPACE multi2
+#endif
+
+namespace MULTI2_NAMESPACE {
 
 template<typename T, size_t N>
 class array {
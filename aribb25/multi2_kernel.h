@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+
+#include "portable.h"
+
+#include "multi2_compat.h"
+#include "multi2_cipher.h"
+
+namespace multi2 {
+
+// One build of the MULTI2 code paths. The SIMD kernels other than the one
+// matching the global compiler flags live in their own translation units
+// (multi2_kernel_*.cc), each compiled with its own -m flags, and are only
+// called once cpuid has shown that the CPU can run them.
+struct kernel {
+	const char *name;
+
+	// dst may equal src for in-place decryption
+	void (* decrypt)(uint8_t *dst, const uint8_t *src, size_t n, const uint32_t *iv, const uint32_t *work_key, int round);
+
+	// no chaining: the caller XORs the previous ciphertext, so blocks from
+	// any number of payloads can share the vector lanes
+	void (* decrypt_ecb)(uint8_t *dst, const uint8_t *src, size_t blocks, const uint32_t *work_key, int round);
+
+	// same, with the key chosen per block: sel holds 8 bytes per block,
+	// 0x00 for work_key0 or 0xff for work_key1
+	void (* decrypt_ecb_mixed)(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t blocks, const uint32_t *work_key0, const uint32_t *work_key1, int round);
+
+	// the encrypting counterparts, used to run the CBC chains of several
+	// payloads side by side
+	void (* encrypt_ecb)(uint8_t *dst, const uint8_t *src, size_t blocks, const uint32_t *work_key, int round);
+	void (* encrypt_ecb_mixed)(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t blocks, const uint32_t *work_key0, const uint32_t *work_key1, int round);
+};
+
+extern const kernel kernel_uint32;
+#if defined(ENABLE_MULTI2_DISPATCH)
+extern const kernel kernel_sse2;
+extern const kernel kernel_sse41;
+extern const kernel kernel_avx2_ymm;
+extern const kernel kernel_avx2_ymm2;
+# if defined(ENABLE_MULTI2_AVX512)
+extern const kernel kernel_avx512_zmm;
+# endif
+// portable vector extension kernel, mostly for checking it against the others
+extern const kernel kernel_vector;
+#else
+extern const kernel kernel_native;
+#endif
+
+#if defined(ENABLE_MULTI2_AUTOTUNE)
+// Times each candidate on synthetic payloads and returns the fastest. The
+// winner is cached per CPU under $XDG_CACHE_HOME/libaribb25, so only the
+// first process start on a machine pays for the measurement.
+const kernel *autotune_kernel(const kernel *const *candidates, size_t count);
+#endif
+
+}
+
+namespace MULTI2_NAMESPACE {
+
+template<typename T>
+struct kernel_functions {
+	static inline work_key_type to_work_key(const uint32_t *work_key) {
+		work_key_type k;
+		for (size_t i = 0; i < k.size(); ++i) {
+			k[i] = work_key[i];
+		}
+		return k;
+	}
+
+	static void decrypt(uint8_t *dst, const uint8_t *src, size_t n, const uint32_t *iv, const uint32_t *work_key, int round) {
+		iv_type v;
+		v[0] = iv[0];
+		v[1] = iv[1];
+
+		// 4 rounds is what ARIB STD-B25 uses, anything else takes the generic loop
+		if (round == 4) {
+			decrypt_cbc_ofb<T>(dst, src, n, v, to_work_key(work_key), fixed_round<4>());
+		} else {
+			decrypt_cbc_ofb<T>(dst, src, n, v, to_work_key(work_key), round);
+		}
+	}
+
+	static void decrypt_ecb(uint8_t *dst, const uint8_t *src, size_t blocks, const uint32_t *work_key, int round) {
+		if (round == 4) {
+			MULTI2_NAMESPACE::decrypt_ecb<T>(dst, src, blocks * block_size<uint32_t>(), to_work_key(work_key), fixed_round<4>());
+		} else {
+			MULTI2_NAMESPACE::decrypt_ecb<T>(dst, src, blocks * block_size<uint32_t>(), to_work_key(work_key), round);
+		}
+	}
+
+	static void decrypt_ecb_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t blocks, const uint32_t *work_key0, const uint32_t *work_key1, int round) {
+		if (round == 4) {
+			MULTI2_NAMESPACE::decrypt_ecb_mixed<T>(dst, src, sel, blocks * block_size<uint32_t>(), to_work_key(work_key0), to_work_key(work_key1), fixed_round<4>());
+		} else {
+			MULTI2_NAMESPACE::decrypt_ecb_mixed<T>(dst, src, sel, blocks * block_size<uint32_t>(), to_work_key(work_key0), to_work_key(work_key1), round);
+		}
+	}
+
+	static void encrypt_ecb(uint8_t *dst, const uint8_t *src, size_t blocks, const uint32_t *work_key, int round) {
+		if (round == 4) {
+			MULTI2_NAMESPACE::encrypt_ecb<T>(dst, src, blocks * block_size<uint32_t>(), to_work_key(work_key), fixed_round<4>());
+		} else {
+			MULTI2_NAMESPACE::encrypt_ecb<T>(dst, src, blocks * block_size<uint32_t>(), to_work_key(work_key), round);
+		}
+	}
+
+	static void encrypt_ecb_mixed(uint8_t *dst, const uint8_t *src, const uint8_t *sel, size_t blocks, const uint32_t *work_key0, const uint32_t *work_key1, int round) {
+		if (round == 4) {
+			MULTI2_NAMESPACE::encrypt_ecb_mixed<T>(dst, src, sel, blocks * block_size<uint32_t>(), to_work_key(work_key0), to_work_key(work_key1), fixed_round<4>());
+		} else {
+			MULTI2_NAMESPACE::encrypt_ecb_mixed<T>(dst, src, sel, blocks * block_size<uint32_t>(), to_work_key(work_key0), to_work_key(work_key1), round);
+		}
+	}
+};
+
+}
+
+// aggregate initializer for a multi2::kernel built from block type T
+#define MULTI2_KERNEL(name, T) { \
+	name, \
+	MULTI2_NAMESPACE::kernel_functions<T >::decrypt, \
+	MULTI2_NAMESPACE::kernel_functions<T >::decrypt_ecb, \
+	MULTI2_NAMESPACE::kernel_functions<T >::decrypt_ecb_mixed, \
+	MULTI2_NAMESPACE::kernel_functions<T >::encrypt_ecb, \
+	MULTI2_NAMESPACE::kernel_functions<T >::encrypt_ecb_mixed, \
+}
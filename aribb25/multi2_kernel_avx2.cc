@@ -0,0 +1,10 @@
+#define MULTI2_NAMESPACE multi2_avx2
+
+#include "multi2_kernel.h"
+
+#if !defined(__AVX2__)
+# error "multi2_kernel_avx2.cc must be built with -mavx2"
+#endif
+
+const multi2::kernel multi2::kernel_avx2_ymm  = MULTI2_KERNEL("avx2-ymm",  MULTI2_NAMESPACE::x86::ymm);
+const multi2::kernel multi2::kernel_avx2_ymm2 = MULTI2_KERNEL("avx2-ymm2", MULTI2_NAMESPACE::x86::ymm2);
@@ -0,0 +1,9 @@
+#define MULTI2_NAMESPACE multi2_avx512
+
+#include "multi2_kernel.h"
+
+#if !defined(__AVX512F__) || !defined(__AVX512BW__)
+# error "multi2_kernel_avx512.cc must be built with -mavx512f -mavx512bw"
+#endif
+
+const multi2::kernel multi2::kernel_avx512_zmm = MULTI2_KERNEL("avx512-zmm", MULTI2_NAMESPACE::x86::zmm);
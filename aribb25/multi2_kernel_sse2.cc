@@ -0,0 +1,9 @@
+#define MULTI2_NAMESPACE multi2_sse2
+
+#include "multi2_kernel.h"
+
+#if !defined(__SSE2__)
+# error "multi2_kernel_sse2.cc must be built with -msse2"
+#endif
+
+const multi2::kernel multi2::kernel_sse2 = MULTI2_KERNEL("sse2", MULTI2_NAMESPACE::x86::xmm);
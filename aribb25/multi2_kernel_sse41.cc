@@ -0,0 +1,9 @@
+#define MULTI2_NAMESPACE multi2_sse41
+
+#include "multi2_kernel.h"
+
+#if !defined(__SSE4_1__)
+# error "multi2_kernel_sse41.cc must be built with -msse4.1"
+#endif
+
+const multi2::kernel multi2::kernel_sse41 = MULTI2_KERNEL("sse4.1", MULTI2_NAMESPACE::x86::xmm);
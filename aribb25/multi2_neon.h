@@ -13,7 +13,7 @@
 
 #include "multi2_block.h"
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 namespace arm {
 
@@ -35,6 +35,7 @@ public:
 	inline neon operator-(const neon &other) const { return vsubq_u32(v, other.v); }
 	inline neon operator^(const neon &other) const { return veorq_u32(v, other.v); }
 	inline neon operator|(const neon &other) const { return vorrq_u32(v, other.v); }
+	inline neon operator&(const neon &other) const { return vandq_u32(v, other.v); }
 
 	inline const uint32x4_t &value() const { return v; }
 };
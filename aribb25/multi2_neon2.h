@@ -9,7 +9,7 @@
 
 #include "multi2_block.h"
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 namespace arm {
 
@@ -45,6 +45,9 @@ public:
 	inline neon2 operator|(const neon2 &other) const {
 		return neon2(vorrq_u32(v0, other.v0), vorrq_u32(v1, other.v1));
 	}
+	inline neon2 operator&(const neon2 &other) const {
+		return neon2(vandq_u32(v0, other.v0), vandq_u32(v1, other.v1));
+	}
 
 	inline const uint32x4_t &value0() const { return v0; }
 	inline const uint32x4_t &value1() const { return v1; }
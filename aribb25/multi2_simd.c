@@ -37,29 +37,25 @@
 //static __m128i Immediate1;
 #define IMMEDIATE1_M256 _mm256_set1_epi32(1)
 
+// shuffle masks are constants, so every instance can share them without any setup
 #ifdef ENABLE_MULTI2_SSSE3
-static __m128i byte_swap_mask;
-static __m128i src_swap_mask;
-static __m128i rotation_16_mask;
-static __m128i rotation_8_mask;
+#define BYTE_SWAP_MASK   _mm_set_epi8(12, 13, 14, 15,  8,  9, 10, 11,  4,  5,  6,  7,  0,  1,  2,  3)
+#define SRC_SWAP_MASK    _mm_set_epi8(12, 13, 14, 15,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3)
+#define ROTATION_16_MASK _mm_set_epi8(13, 12, 15, 14,  9,  8, 11, 10,  5,  4,  7,  6,  1,  0,  3,  2)
+#define ROTATION_8_MASK  _mm_set_epi8(14, 13, 12, 15, 10,  9,  8, 11,  6,  5,  4,  7,  2,  1,  0,  3)
 #endif
 
 #ifdef ENABLE_MULTI2_AVX2
-static __m256i byte_swap_mask_avx2;
-static __m256i src_swap_mask_avx2;
-static __m256i rotation_16_mask_avx2;
-static __m256i rotation_8_mask_avx2;
+#define BYTE_SWAP_MASK_AVX2   _mm256_broadcastsi128_si256(BYTE_SWAP_MASK)
+#define SRC_SWAP_MASK_AVX2    _mm256_broadcastsi128_si256(SRC_SWAP_MASK)
+#define ROTATION_16_MASK_AVX2 _mm256_broadcastsi128_si256(ROTATION_16_MASK)
+#define ROTATION_8_MASK_AVX2  _mm256_broadcastsi128_si256(ROTATION_8_MASK)
 #endif
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  inner variables
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-#define MULTI2_SIMD_SCRAMBLE_ROUND 4
-static uint32_t scramble_round = MULTI2_SIMD_SCRAMBLE_ROUND;
 #define MAX_SCRAMBLE_ROUND MULTI2_SIMD_SCRAMBLE_ROUND
-//#define MAX_SCRAMBLE_ROUND scramble_round
-static enum INSTRUCTION_TYPE simd_instruction = INSTRUCTION_NORMAL;
-static bool is_mask_initialized = false;
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  function prototypes (private method)
@@ -322,7 +318,7 @@ static inline void round_pi4_sse2_with_3sets(__m128i *left1, __m128i *right1,
 
 static inline __m128i byte_swap_ssse3(const __m128i *value)
 {
-	return _mm_shuffle_epi8(*value, byte_swap_mask);
+	return _mm_shuffle_epi8(*value, BYTE_SWAP_MASK);
 }
 
 #define round_pi1_ssse3 round_pi1_sse2
@@ -336,10 +332,10 @@ static inline void round_pi3_ssse3(__m128i *left, __m128i *right,
 
 	t = _mm_add_epi32(*left, *key2);
 	t = _mm_add_epi32(_mm_add_epi32(left_rotate_m128i(&t, 2), t), IMMEDIATE1);
-	t = _mm_xor_si128(_mm_shuffle_epi8(t, rotation_8_mask), t);
+	t = _mm_xor_si128(_mm_shuffle_epi8(t, ROTATION_8_MASK), t);
 	t = _mm_add_epi32(t, *key3);
 	t = _mm_sub_epi32(left_rotate_m128i(&t, 1), t);
-	t = _mm_xor_si128(_mm_shuffle_epi8(t, rotation_16_mask), _mm_or_si128(t, *left));
+	t = _mm_xor_si128(_mm_shuffle_epi8(t, ROTATION_16_MASK), _mm_or_si128(t, *left));
 
 	*right = _mm_xor_si128(*right, t);
 }
@@ -366,18 +362,18 @@ static inline void round_pi3_ssse3_with_3sets(__m128i *left1, __m128i *right1,
 	t1 = _mm_add_epi32(t1, IMMEDIATE1);
 	t2 = _mm_add_epi32(t2, IMMEDIATE1);
 	t3 = _mm_add_epi32(t3, IMMEDIATE1);
-	t1 = _mm_xor_si128(_mm_shuffle_epi8(t1, rotation_8_mask), t1);
-	t2 = _mm_xor_si128(_mm_shuffle_epi8(t2, rotation_8_mask), t2);
-	t3 = _mm_xor_si128(_mm_shuffle_epi8(t3, rotation_8_mask), t3);
+	t1 = _mm_xor_si128(_mm_shuffle_epi8(t1, ROTATION_8_MASK), t1);
+	t2 = _mm_xor_si128(_mm_shuffle_epi8(t2, ROTATION_8_MASK), t2);
+	t3 = _mm_xor_si128(_mm_shuffle_epi8(t3, ROTATION_8_MASK), t3);
 	t1 = _mm_add_epi32(t1, *key3);
 	t2 = _mm_add_epi32(t2, *key3);
 	t3 = _mm_add_epi32(t3, *key3);
 	t1 = _mm_sub_epi32(left_rotate_m128i(&t1, 1), t1);
 	t2 = _mm_sub_epi32(left_rotate_m128i(&t2, 1), t2);
 	t3 = _mm_sub_epi32(left_rotate_m128i(&t3, 1), t3);
-	t1 = _mm_xor_si128(_mm_shuffle_epi8(t1, rotation_16_mask), _mm_or_si128(t1, *left1));
-	t2 = _mm_xor_si128(_mm_shuffle_epi8(t2, rotation_16_mask), _mm_or_si128(t2, *left2));
-	t3 = _mm_xor_si128(_mm_shuffle_epi8(t3, rotation_16_mask), _mm_or_si128(t3, *left3));
+	t1 = _mm_xor_si128(_mm_shuffle_epi8(t1, ROTATION_16_MASK), _mm_or_si128(t1, *left1));
+	t2 = _mm_xor_si128(_mm_shuffle_epi8(t2, ROTATION_16_MASK), _mm_or_si128(t2, *left2));
+	t3 = _mm_xor_si128(_mm_shuffle_epi8(t3, ROTATION_16_MASK), _mm_or_si128(t3, *left3));
 	*right1 = _mm_xor_si128(*right1, t1);
 	*right2 = _mm_xor_si128(*right2, t2);
 	*right3 = _mm_xor_si128(*right3, t3);
@@ -391,7 +387,7 @@ static inline void round_pi3_ssse3_with_3sets(__m128i *left1, __m128i *right1,
 
 static inline __m256i byte_swap_avx2(const __m256i *value)
 {
-	return _mm256_shuffle_epi8(*value, byte_swap_mask_avx2);
+	return _mm256_shuffle_epi8(*value, BYTE_SWAP_MASK_AVX2);
 }
 
 static inline __m256i left_rotate_m256i(const __m256i *value, const int rotate)
@@ -449,10 +445,10 @@ static inline void round_pi3_avx2(__m256i *left, __m256i *right, const __m256i *
 
 	t = _mm256_add_epi32(*left, *key2);
 	t = _mm256_add_epi32(_mm256_add_epi32(left_rotate_m256i(&t, 2), t), IMMEDIATE1_M256);
-	t = _mm256_xor_si256(_mm256_shuffle_epi8(t, rotation_8_mask_avx2), t);
+	t = _mm256_xor_si256(_mm256_shuffle_epi8(t, ROTATION_8_MASK_AVX2), t);
 	t = _mm256_add_epi32(t, *key3);
 	t = _mm256_sub_epi32(left_rotate_m256i(&t, 1), t);
-	t = _mm256_xor_si256(_mm256_shuffle_epi8(t, rotation_16_mask_avx2), _mm256_or_si256(t, *left));
+	t = _mm256_xor_si256(_mm256_shuffle_epi8(t, ROTATION_16_MASK_AVX2), _mm256_or_si256(t, *left));
 
 	*right = _mm256_xor_si256(*right, t);
 }
@@ -553,18 +549,18 @@ static inline void round_pi3_avx2_with_3sets(__m256i *left1, __m256i *right1,
 	t1 = _mm256_add_epi32(t1, IMMEDIATE1_M256);
 	t2 = _mm256_add_epi32(t2, IMMEDIATE1_M256);
 	t3 = _mm256_add_epi32(t3, IMMEDIATE1_M256);
-	t1 = _mm256_xor_si256(_mm256_shuffle_epi8(t1, rotation_8_mask_avx2), t1);
-	t2 = _mm256_xor_si256(_mm256_shuffle_epi8(t2, rotation_8_mask_avx2), t2);
-	t3 = _mm256_xor_si256(_mm256_shuffle_epi8(t3, rotation_8_mask_avx2), t3);
+	t1 = _mm256_xor_si256(_mm256_shuffle_epi8(t1, ROTATION_8_MASK_AVX2), t1);
+	t2 = _mm256_xor_si256(_mm256_shuffle_epi8(t2, ROTATION_8_MASK_AVX2), t2);
+	t3 = _mm256_xor_si256(_mm256_shuffle_epi8(t3, ROTATION_8_MASK_AVX2), t3);
 	t1 = _mm256_add_epi32(t1, *key3);
 	t2 = _mm256_add_epi32(t2, *key3);
 	t3 = _mm256_add_epi32(t3, *key3);
 	t1 = _mm256_sub_epi32(left_rotate_m256i(&t1, 1), t1);
 	t2 = _mm256_sub_epi32(left_rotate_m256i(&t2, 1), t2);
 	t3 = _mm256_sub_epi32(left_rotate_m256i(&t3, 1), t3);
-	t1 = _mm256_xor_si256(_mm256_shuffle_epi8(t1, rotation_16_mask_avx2), _mm256_or_si256(t1, *left1));
-	t2 = _mm256_xor_si256(_mm256_shuffle_epi8(t2, rotation_16_mask_avx2), _mm256_or_si256(t2, *left2));
-	t3 = _mm256_xor_si256(_mm256_shuffle_epi8(t3, rotation_16_mask_avx2), _mm256_or_si256(t3, *left3));
+	t1 = _mm256_xor_si256(_mm256_shuffle_epi8(t1, ROTATION_16_MASK_AVX2), _mm256_or_si256(t1, *left1));
+	t2 = _mm256_xor_si256(_mm256_shuffle_epi8(t2, ROTATION_16_MASK_AVX2), _mm256_or_si256(t2, *left2));
+	t3 = _mm256_xor_si256(_mm256_shuffle_epi8(t3, ROTATION_16_MASK_AVX2), _mm256_or_si256(t3, *left3));
 	*right1 = _mm256_xor_si256(*right1, t1);
 	*right2 = _mm256_xor_si256(*right2, t2);
 	*right3 = _mm256_xor_si256(*right3, t3);
@@ -598,20 +594,6 @@ static inline void round_pi4_avx2_with_3sets(__m256i *left1, __m256i *right1,
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  global function implementation
  ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
-bool is_simd_enabled()
-{
-#ifdef ENABLE_MULTI2_SIMD
-#ifdef _MSC_VER
-	__assume(simd_instruction != INSTRUCTION_NORMAL);
-	return simd_instruction != INSTRUCTION_NORMAL;
-#else
-	return __builtin_expect(simd_instruction != INSTRUCTION_NORMAL, 1);
-#endif
-#else
-	return false;
-#endif
-}
-
 bool is_sse2_available()
 {
 #if defined(_M_IX86)
@@ -674,62 +656,17 @@ bool is_avx2_available()
 	return false;
 }
 
-bool initialize_multi2_simd(enum INSTRUCTION_TYPE instruction, void* m2)
+enum INSTRUCTION_TYPE initialize_multi2_simd(enum INSTRUCTION_TYPE instruction)
 {
 	if (!is_sse2_available() || instruction == INSTRUCTION_NORMAL) {
-		set_simd_instruction(INSTRUCTION_NORMAL);
-		return false;
+		return INSTRUCTION_NORMAL;
 	}
 
 	enum INSTRUCTION_TYPE supported_instruction = get_supported_simd_instruction();
-	if (!is_mask_initialized) {
-#ifdef ENABLE_MULTI2_AVX2
-		if (supported_instruction >= INSTRUCTION_AVX2) {
-			byte_swap_mask_avx2   = _mm256_set_epi8(
-				12, 13, 14, 15,  8,  9, 10, 11,  4,  5,  6,  7,  0,  1,  2,  3,
-				12, 13, 14, 15,  8,  9, 10, 11,  4,  5,  6,  7,  0,  1,  2,  3
-			);
-			src_swap_mask_avx2    = _mm256_set_epi8(
-				12, 13, 14, 15,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3,
-				12, 13, 14, 15,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3
-			);
-			rotation_16_mask_avx2 = _mm256_set_epi8(
-				13, 12, 15, 14,  9,  8, 11, 10,  5,  4,  7,  6,  1,  0,  3,  2,
-				13, 12, 15, 14,  9,  8, 11, 10,  5,  4,  7,  6,  1,  0,  3,  2
-			);
-			rotation_8_mask_avx2  = _mm256_set_epi8(
-				14, 13, 12, 15, 10,  9,  8, 11,  6,  5,  4,  7,  2,  1,  0,  3,
-				14, 13, 12, 15, 10,  9,  8, 11,  6,  5,  4,  7,  2,  1,  0,  3
-			);
-		}
-#endif
-#if defined(ENABLE_MULTI2_SSSE3)// || defined(ENABLE_MULTI2_AVX2)
-		if (supported_instruction >= INSTRUCTION_SSSE3) {
-			byte_swap_mask   = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
-			src_swap_mask    = _mm_set_epi8(12, 13, 14, 15, 4, 5, 6, 7, 8, 9, 10, 11, 0, 1, 2, 3);
-			rotation_16_mask = _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
-			rotation_8_mask  = _mm_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
-		}
-#endif
-		is_mask_initialized = true;
-	}
-
 	if (instruction <= supported_instruction) {
-		set_simd_instruction(instruction);
-	} else {
-		set_simd_instruction(supported_instruction);
+		return instruction;
 	}
-	return true;
-}
-
-void set_simd_instruction(enum INSTRUCTION_TYPE instruction)
-{
-	simd_instruction = instruction;
-}
-
-enum INSTRUCTION_TYPE get_simd_instruction()
-{
-	return simd_instruction;
+	return supported_instruction;
 }
 
 enum INSTRUCTION_TYPE get_supported_simd_instruction()
@@ -787,11 +724,6 @@ void set_work_key_for_avx2(MULTI2_SIMD_WORK_KEY *work_key, const MULTI2_SIMD_SYS
 #endif
 }
 
-void set_round_for_simd(const uint32_t round)
-{
-	scramble_round = round;
-}
-
 void set_system_key_with_bswap(MULTI2_SIMD_SYS_KEY *sys_key, const uint8_t *hex_data)
 {
 	// reverse byte order
@@ -1299,9 +1231,9 @@ void decrypt_multi2_with_ssse3(uint8_t * __restrict data, const uint32_t size,
 			src2 = _mm_loadu_si128((__m128i*)(p + 16));
 
 			// r2 r1 l2 l1
-			x = _mm_shuffle_epi8(src1, src_swap_mask);
+			x = _mm_shuffle_epi8(src1, SRC_SWAP_MASK);
 			// r4 r3 l4 l3
-			y = _mm_shuffle_epi8(src2, src_swap_mask);
+			y = _mm_shuffle_epi8(src2, SRC_SWAP_MASK);
 
 			// l4 l3 l2 l1
 			left  = _mm_unpacklo_epi64(x, y);
@@ -1354,12 +1286,12 @@ void decrypt_multi2_with_ssse3(uint8_t * __restrict data, const uint32_t size,
 			src5 = _mm_loadu_si128((__m128i*)(p + 64));
 			src6 = _mm_loadu_si128((__m128i*)(p + 80));
 
-			x1 = _mm_shuffle_epi8(src1, src_swap_mask);
-			y1 = _mm_shuffle_epi8(src2, src_swap_mask);
-			x2 = _mm_shuffle_epi8(src3, src_swap_mask);
-			y2 = _mm_shuffle_epi8(src4, src_swap_mask);
-			x3 = _mm_shuffle_epi8(src5, src_swap_mask);
-			y3 = _mm_shuffle_epi8(src6, src_swap_mask);
+			x1 = _mm_shuffle_epi8(src1, SRC_SWAP_MASK);
+			y1 = _mm_shuffle_epi8(src2, SRC_SWAP_MASK);
+			x2 = _mm_shuffle_epi8(src3, SRC_SWAP_MASK);
+			y2 = _mm_shuffle_epi8(src4, SRC_SWAP_MASK);
+			x3 = _mm_shuffle_epi8(src5, SRC_SWAP_MASK);
+			y3 = _mm_shuffle_epi8(src6, SRC_SWAP_MASK);
 
 			left1  = _mm_unpacklo_epi64(x1, y1);
 			right1 = _mm_unpackhi_epi64(x1, y1);
@@ -1436,9 +1368,9 @@ void decrypt_multi2_with_ssse3(uint8_t * __restrict data, const uint32_t size,
 		src2 = _mm_loadu_si128((__m128i*)(p + 16));
 
 		// r2 r1 l2 l1
-		x = _mm_shuffle_epi8(src1, src_swap_mask);
+		x = _mm_shuffle_epi8(src1, SRC_SWAP_MASK);
 		// r4 r3 l4 l3
-		y = _mm_shuffle_epi8(src2, src_swap_mask);
+		y = _mm_shuffle_epi8(src2, SRC_SWAP_MASK);
 
 		// l4 l3 l2 l1
 		left  = _mm_unpacklo_epi64(x, y);
@@ -1573,9 +1505,9 @@ void decrypt_multi2_with_avx2(uint8_t * __restrict data, const uint32_t size,
 			src3 = _mm256_loadu_si256((__m256i*)(p + 32 - 8));
 
 			// r4 r3 l4 l3 r2 r1 l2 l1
-			x = _mm256_shuffle_epi8(src1, src_swap_mask_avx2);
+			x = _mm256_shuffle_epi8(src1, SRC_SWAP_MASK_AVX2);
 			// r8 r7 l8 l7 r6 r5 l6 l5
-			y = _mm256_shuffle_epi8(src2, src_swap_mask_avx2);
+			y = _mm256_shuffle_epi8(src2, SRC_SWAP_MASK_AVX2);
 
 			// l8 l7 l6 l5 l4 l3 l2 l1
 			left  = _mm256_unpacklo_epi64(x, y);
@@ -1628,12 +1560,12 @@ void decrypt_multi2_with_avx2(uint8_t * __restrict data, const uint32_t size,
 		src5 = _mm256_loadu_si256((__m256i*)(p + 128 - 8));
 		src6 = _mm256_loadu_si256((__m256i*)(p + 160 - 8));
 
-		x1 = _mm256_shuffle_epi8(src1, src_swap_mask_avx2);
-		y1 = _mm256_shuffle_epi8(src2, src_swap_mask_avx2);
-		x2 = _mm256_shuffle_epi8(src3, src_swap_mask_avx2);
-		y2 = _mm256_shuffle_epi8(src4, src_swap_mask_avx2);
-		x3 = _mm256_shuffle_epi8(src5, src_swap_mask_avx2);
-		y3 = _mm256_shuffle_epi8(src6, src_swap_mask_avx2);
+		x1 = _mm256_shuffle_epi8(src1, SRC_SWAP_MASK_AVX2);
+		y1 = _mm256_shuffle_epi8(src2, SRC_SWAP_MASK_AVX2);
+		x2 = _mm256_shuffle_epi8(src3, SRC_SWAP_MASK_AVX2);
+		y2 = _mm256_shuffle_epi8(src4, SRC_SWAP_MASK_AVX2);
+		x3 = _mm256_shuffle_epi8(src5, SRC_SWAP_MASK_AVX2);
+		y3 = _mm256_shuffle_epi8(src6, SRC_SWAP_MASK_AVX2);
 
 		left1  = _mm256_unpacklo_epi64(x1, y1);
 		right1 = _mm256_unpackhi_epi64(x1, y1);
@@ -1717,9 +1649,9 @@ void decrypt_multi2_with_avx2(uint8_t * __restrict data, const uint32_t size,
 		src3 = _mm256_loadu_si256((__m256i*)(p + 32 - 8));
 
 		// r4 r3 l4 l3 r2 r1 l2 l1
-		x = _mm256_shuffle_epi8(src1, src_swap_mask_avx2);
+		x = _mm256_shuffle_epi8(src1, SRC_SWAP_MASK_AVX2);
 		// r8 r7 l8 l7 r6 r5 l6 l5
-		y = _mm256_shuffle_epi8(src2, src_swap_mask_avx2);
+		y = _mm256_shuffle_epi8(src2, SRC_SWAP_MASK_AVX2);
 
 		// l8 l7 l6 l5 l4 l3 l2 l1
 		left  = _mm256_unpacklo_epi64(x, y);
@@ -1764,9 +1696,9 @@ void decrypt_multi2_with_avx2(uint8_t * __restrict data, const uint32_t size,
 		src2 = _mm_loadu_si128((__m128i*)(p + 16));
 
 		// r2 r1 l2 l1
-		x = _mm_shuffle_epi8(src1, src_swap_mask);
+		x = _mm_shuffle_epi8(src1, SRC_SWAP_MASK);
 		// r4 r3 l4 l3
-		y = _mm_shuffle_epi8(src2, src_swap_mask);
+		y = _mm_shuffle_epi8(src2, SRC_SWAP_MASK);
 
 		// l4 l3 l2 l1
 		left  = _mm_unpacklo_epi64(x, y);
@@ -28,6 +28,8 @@
 
 #endif	// ENABLE_MULTI2_SIMD
 
+#define MULTI2_SIMD_SCRAMBLE_ROUND 4	// the SIMD paths always run this many rounds
+
 
 #ifdef ENABLE_MULTI2_AVX2
 
@@ -78,6 +80,7 @@ typedef struct {
 					 const MULTI2_SIMD_SYS_KEY * __restrict work_key,
 					 const MULTI2_SIMD_WORK_KEY * __restrict packed_work_key,
 					 const MULTI2_SIMD_DATA_KEY * __restrict cbc_init);
+	enum INSTRUCTION_TYPE instruction; /* instruction set of decrypt and wrk */
 
 } MULTI2_SIMD_DATA /* data set for SIMD */;
 
@@ -86,21 +89,17 @@ typedef struct {
 extern "C" {
 #endif
 
-extern bool is_simd_enabled();
 extern bool is_sse2_available();
 extern bool is_ssse3_available();
 extern bool is_avx2_available();
-extern bool initialize_multi2_simd(enum INSTRUCTION_TYPE instruction, void* m2);
+extern enum INSTRUCTION_TYPE initialize_multi2_simd(enum INSTRUCTION_TYPE instruction);
 
-extern void set_simd_instruction(enum INSTRUCTION_TYPE instruction);
-extern enum INSTRUCTION_TYPE get_simd_instruction();
 extern enum INSTRUCTION_TYPE get_supported_simd_instruction();
 
 extern void alloc_work_key_for_simd(MULTI2_SIMD_WORK_KEY **work_key_odd, MULTI2_SIMD_WORK_KEY **work_key_even);
 extern void free_work_key_for_simd(MULTI2_SIMD_WORK_KEY **work_key_odd, MULTI2_SIMD_WORK_KEY **work_key_even);
 extern void set_work_key_for_simd(MULTI2_SIMD_WORK_KEY *work_key, const MULTI2_SIMD_SYS_KEY *src_key);
 extern void set_work_key_for_avx2(MULTI2_SIMD_WORK_KEY *work_key, const MULTI2_SIMD_SYS_KEY *src_key);
-extern void set_round_for_simd(const uint32_t round);
 extern void set_system_key_with_bswap(MULTI2_SIMD_SYS_KEY *sys_key, const uint8_t *hex_data);
 extern void get_system_key_with_bswap(const MULTI2_SIMD_SYS_KEY *sys_key, uint8_t *hex_data);
 extern void set_data_key_with_bswap(MULTI2_SIMD_DATA_KEY *data_key, const uint8_t *hex_data);
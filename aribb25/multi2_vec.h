@@ -0,0 +1,126 @@
+#pragma once
+
+#if defined(__GNUC__)
+
+#include <utility>
+
+#include "portable.h"
+
+#include "multi2_block.h"
+
+namespace MULTI2_NAMESPACE {
+
+namespace generic {
+
+// vector_size() on a dependent typedef is ignored by some GCC versions
+template<size_t N>
+struct vector_of;
+
+template<>
+struct vector_of<4> {
+	typedef uint32_t type __attribute__((vector_size(16)));
+};
+
+template<>
+struct vector_of<8> {
+	typedef uint32_t type __attribute__((vector_size(32)));
+};
+
+// N lanes of GCC/Clang vector extensions, one block per lane in memory
+// order. The compiler picks the instructions, so this covers targets with
+// vector registers but no hand-written block type (POWER, s390x, ...).
+template<size_t N>
+class vec {
+public:
+	typedef typename vector_of<N>::type value_type;
+
+private:
+	value_type v;
+
+public:
+	inline vec() { }
+	inline vec(uint32_t n) { v = value_type() + n; }
+	inline vec(const value_type &r) { v = r; }
+
+	inline vec &operator=(const vec &other) {
+		v = other.v;
+		return *this;
+	}
+
+	inline vec operator+(const vec &other) const { return v + other.v; }
+	inline vec operator-(const vec &other) const { return v - other.v; }
+	inline vec operator^(const vec &other) const { return v ^ other.v; }
+	inline vec operator|(const vec &other) const { return v | other.v; }
+	inline vec operator&(const vec &other) const { return v & other.v; }
+	inline vec operator<<(int n) const { return v << n; }
+	inline vec operator>>(int n) const { return v >> n; }
+
+	inline const value_type &value() const { return v; }
+
+	static inline void load_block(block<vec> &b, const uint8_t *p) {
+		value_type l, r;
+		for (size_t i = 0; i < N; ++i) {
+			l[i] = load_be(p + i * 8);
+			r[i] = load_be(p + i * 8 + 4);
+		}
+		b.left  = l;
+		b.right = r;
+	}
+
+	static inline void store_block(uint8_t *p, const block<vec> &b) {
+		for (size_t i = 0; i < N; ++i) {
+			store_be(p + i * 8,     b.left.v[i]);
+			store_be(p + i * 8 + 4, b.right.v[i]);
+		}
+	}
+
+	// plaintext of lane i is its decrypted block XOR the ciphertext of lane i - 1
+	static inline std::pair<block<vec>, cbc_state> cbc_post_decrypt(const block<vec> &d, const block<vec> &c, const cbc_state &state) {
+		value_type x0, x1;
+		x0[0] = state.left;
+		x1[0] = state.right;
+		for (size_t i = 1; i < N; ++i) {
+			x0[i] = c.left.v[i - 1];
+			x1[i] = c.right.v[i - 1];
+		}
+
+		block<vec> p(d.left.v ^ x0, d.right.v ^ x1);
+		return std::make_pair(p, cbc_state(c.left.v[N - 1], c.right.v[N - 1]));
+	}
+};
+
+}
+
+template<>
+inline void block<generic::vec<4> >::load(const uint8_t *p) {
+	generic::vec<4>::load_block(*this, p);
+}
+
+template<>
+inline void block<generic::vec<8> >::load(const uint8_t *p) {
+	generic::vec<8>::load_block(*this, p);
+}
+
+template<>
+inline void block<generic::vec<4> >::store(uint8_t *p) const {
+	generic::vec<4>::store_block(p, *this);
+}
+
+template<>
+inline void block<generic::vec<8> >::store(uint8_t *p) const {
+	generic::vec<8>::store_block(p, *this);
+}
+
+template<>
+inline std::pair<block<generic::vec<4> >, cbc_state> block<generic::vec<4> >::cbc_post_decrypt(const block<generic::vec<4> > &c, const cbc_state &state) const {
+	return generic::vec<4>::cbc_post_decrypt(*this, c, state);
+}
+
+template<>
+inline std::pair<block<generic::vec<8> >, cbc_state> block<generic::vec<8> >::cbc_post_decrypt(const block<generic::vec<8> > &c, const cbc_state &state) const {
+	return generic::vec<8>::cbc_post_decrypt(*this, c, state);
+}
+
+}
+
+#endif /* __GNUC__ */
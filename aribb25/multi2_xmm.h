@@ -14,7 +14,7 @@
 
 #include "multi2_block.h"
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 namespace x86 {
 
@@ -40,6 +40,7 @@ public:
 	inline xmm operator-(const xmm &other) const { return _mm_sub_epi32(v, other.v); }
 	inline xmm operator^(const xmm &other) const { return _mm_xor_si128(v, other.v); }
 	inline xmm operator|(const xmm &other) const { return _mm_or_si128(v, other.v); }
+	inline xmm operator&(const xmm &other) const { return _mm_and_si128(v, other.v); }
 	inline xmm operator<<(int n) const { return _mm_slli_epi32(v, n); }
 	inline xmm operator>>(int n) const { return _mm_srli_epi32(v, n); }
 
@@ -14,7 +14,7 @@
 
 #include "multi2_block.h"
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 namespace x86 {
 
@@ -40,6 +40,7 @@ public:
 	inline ymm operator-(const ymm &other) const { return _mm256_sub_epi32(v, other.v); }
 	inline ymm operator^(const ymm &other) const { return _mm256_xor_si256(v, other.v); }
 	inline ymm operator|(const ymm &other) const { return _mm256_or_si256(v, other.v); }
+	inline ymm operator&(const ymm &other) const { return _mm256_and_si256(v, other.v); }
 	inline ymm operator<<(int n) const { return _mm256_slli_epi32(v, n); }
 	inline ymm operator>>(int n) const { return _mm256_srli_epi32(v, n); }
 
@@ -14,7 +14,7 @@
 
 #include "multi2_block.h"
 
-namespace multi2 {
+namespace MULTI2_NAMESPACE {
 
 namespace x86 {
 
@@ -53,6 +53,9 @@ public:
 	inline ymm2 operator|(const ymm2 &other) const {
 		return x86::ymm2(_mm256_or_si256(v0, other.v0), _mm256_or_si256(v1, other.v1));
 	}
+	inline ymm2 operator&(const ymm2 &other) const {
+		return x86::ymm2(_mm256_and_si256(v0, other.v0), _mm256_and_si256(v1, other.v1));
+	}
 	inline ymm2 operator<<(int n) const {
 		return x86::ymm2(_mm256_slli_epi32(v0, n), _mm256_slli_epi32(v1, n));
 	}
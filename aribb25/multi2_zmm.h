@@ -0,0 +1,180 @@
+#pragma once
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+
+#include <utility>
+
+#if defined(_WIN32)
+# include <intrin.h>
+#else
+# include <x86intrin.h>
+#endif
+
+#include "portable.h"
+
+#include "multi2_block.h"
+
+namespace MULTI2_NAMESPACE {
+
+namespace x86 {
+
+// GCC's unmasked forms of vpsrld, vprold, vpermd and valignd pass
+// _mm512_undefined_epi32() as the merge source and trip -Wmaybe-uninitialized
+// at -O3; the masked forms below take every lane with the source itself
+// merged in instead and compile to the same instructions
+static const __mmask16 all_lanes = static_cast<__mmask16>(0xffff);
+
+// lane 0 as a scalar; GCC's _mm512_castsi512_si128() goes through
+// vextracti32x4 with an undefined source as well
+static inline uint32_t low_lane(__m512i a) {
+#if defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 11)
+	return static_cast<uint32_t>(_mm512_cvtsi512_si32(a));
+#else
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm512_castsi512_si128(a)));
+#endif
+}
+
+class zmm {
+private:
+	__m512i v;
+
+public:
+	inline zmm() {
+#if !defined(NO_MM_UNDEFINED)
+		v = _mm512_undefined_epi32();
+#endif
+	}
+	inline zmm(uint32_t n) { v = _mm512_set1_epi32(n); }
+	inline zmm(const __m512i &r) { v = r; }
+
+	inline zmm &operator=(const zmm &other) {
+		v = other.v;
+		return *this;
+	}
+
+	inline zmm operator+(const zmm &other) const { return _mm512_add_epi32(v, other.v); }
+	inline zmm operator-(const zmm &other) const { return _mm512_sub_epi32(v, other.v); }
+	inline zmm operator^(const zmm &other) const { return _mm512_xor_si512(v, other.v); }
+	inline zmm operator|(const zmm &other) const { return _mm512_or_si512(v, other.v); }
+	inline zmm operator&(const zmm &other) const { return _mm512_and_si512(v, other.v); }
+	inline zmm operator<<(int n) const { return _mm512_slli_epi32(v, n); }
+	inline zmm operator>>(int n) const { return _mm512_mask_srli_epi32(v, all_lanes, v, n); }
+
+	inline const __m512i &value() const { return v; }
+
+	// masks covering the first k (< 16) blocks of the two 64-byte halves
+	static inline __mmask16 mask0(size_t k) {
+		return (k < 8) ? static_cast<__mmask16>((1u << (k * 2)) - 1) : static_cast<__mmask16>(0xffff);
+	}
+	static inline __mmask16 mask1(size_t k) {
+		return (k > 8) ? static_cast<__mmask16>((1u << ((k - 8) * 2)) - 1) : static_cast<__mmask16>(0);
+	}
+
+	static inline void load_block(block<zmm> &b, __m512i a0, __m512i a1) {
+		__m512i s = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+		__m512i b0 = _mm512_shuffle_epi8(a0, s); // 0f .. 01 00 - ABCD
+		__m512i b1 = _mm512_shuffle_epi8(a1, s); // 1f .. 11 10 - ABCD
+
+		__m512i l = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+		__m512i r = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1);
+		b.left  = _mm512_permutex2var_epi32(b0, l, b1); // 1e 1c .. 02 00
+		b.right = _mm512_permutex2var_epi32(b0, r, b1); // 1f 1d .. 03 01
+	}
+
+	static inline void store_block(__m512i &c0, __m512i &c1, const block<zmm> &b) {
+		__m512i a0 = b.left.value();  // 1e 1c .. 02 00
+		__m512i a1 = b.right.value(); // 1f 1d .. 03 01
+
+		__m512i l = _mm512_set_epi32(23, 7, 22, 6, 21, 5, 20, 4, 19, 3, 18, 2, 17, 1, 16, 0);
+		__m512i h = _mm512_set_epi32(31, 15, 30, 14, 29, 13, 28, 12, 27, 11, 26, 10, 25, 9, 24, 8);
+		__m512i b0 = _mm512_permutex2var_epi32(a0, l, a1); // 0f .. 01 00 - ABCD
+		__m512i b1 = _mm512_permutex2var_epi32(a0, h, a1); // 1f .. 11 10 - ABCD
+
+		__m512i s = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+		c0 = _mm512_shuffle_epi8(b0, s); // DCBA
+		c1 = _mm512_shuffle_epi8(b1, s);
+	}
+
+	// the first k lanes of a block hold the blocks at p, the rest are zero
+	static inline void load_block_partial(block<zmm> &b, const uint8_t *p, size_t k) {
+		__m512i a0 = _mm512_maskz_loadu_epi32(mask0(k), p);
+		__m512i a1 = _mm512_maskz_loadu_epi32(mask1(k), p + 64);
+		load_block(b, a0, a1);
+	}
+
+	static inline void store_block_partial(uint8_t *p, const block<zmm> &b, size_t k) {
+		__m512i c0, c1;
+		store_block(c0, c1, b);
+		_mm512_mask_storeu_epi32(p,      mask0(k), c0);
+		_mm512_mask_storeu_epi32(p + 64, mask1(k), c1);
+	}
+
+	// k is the number of valid lanes; the ciphertext of the last one is the next state
+	static inline std::pair<block<zmm>, cbc_state> cbc_post_decrypt(const block<zmm> &d, const block<zmm> &c, const cbc_state &state, size_t k) {
+		__m512i c0 = c.left.value();  // f e .. 1 0
+		__m512i c1 = c.right.value();
+
+		__m512i i = _mm512_set1_epi32(static_cast<int>(k - 1));
+		uint32_t s0 = low_lane(_mm512_mask_permutexvar_epi32(c0, all_lanes, i, c0));
+		uint32_t s1 = low_lane(_mm512_mask_permutexvar_epi32(c1, all_lanes, i, c1));
+
+		__m512i x0 = _mm512_mask_alignr_epi32(c0, all_lanes, c0, _mm512_set1_epi32(state.left),  15); // e d .. 0 s
+		__m512i x1 = _mm512_mask_alignr_epi32(c1, all_lanes, c1, _mm512_set1_epi32(state.right), 15);
+
+		__m512i p0 = _mm512_xor_si512(d.left.value(),  x0);
+		__m512i p1 = _mm512_xor_si512(d.right.value(), x1);
+
+		return std::make_pair(block<zmm>(p0, p1), cbc_state(s0, s1));
+	}
+};
+
+}
+
+template<>
+inline void block<x86::zmm>::load(const uint8_t *p) {
+	__m512i a0 = _mm512_loadu_si512(p);      // 07 .. 00 - DCBA
+	__m512i a1 = _mm512_loadu_si512(p + 64); // 0f .. 08 - DCBA
+	x86::zmm::load_block(*this, a0, a1);
+}
+
+template<>
+inline void block<x86::zmm>::store(uint8_t *p) const {
+	__m512i c0, c1;
+	x86::zmm::store_block(c0, c1, *this);
+	_mm512_storeu_si512(p,      c0);
+	_mm512_storeu_si512(p + 64, c1);
+}
+
+template<>
+inline std::pair<block<x86::zmm>, cbc_state> block<x86::zmm>::cbc_post_decrypt(const block<x86::zmm> &c, const cbc_state &state) const {
+	return x86::zmm::cbc_post_decrypt(*this, c, state, 16);
+}
+
+template<>
+inline x86::zmm rot<1, x86::zmm>(const x86::zmm &v) {
+	return _mm512_mask_rol_epi32(v.value(), x86::all_lanes, v.value(), 1);
+}
+
+template<>
+inline x86::zmm rot<2, x86::zmm>(const x86::zmm &v) {
+	return _mm512_mask_rol_epi32(v.value(), x86::all_lanes, v.value(), 2);
+}
+
+template<>
+inline x86::zmm rot<4, x86::zmm>(const x86::zmm &v) {
+	return _mm512_mask_rol_epi32(v.value(), x86::all_lanes, v.value(), 4);
+}
+
+template<>
+inline x86::zmm rot<8, x86::zmm>(const x86::zmm &v) {
+	return _mm512_mask_rol_epi32(v.value(), x86::all_lanes, v.value(), 8);
+}
+
+template<>
+inline x86::zmm rot<16, x86::zmm>(const x86::zmm &v) {
+	return _mm512_mask_rol_epi32(v.value(), x86::all_lanes, v.value(), 16);
+}
+
+}
+
+#endif /* __AVX512F__ && __AVX512BW__ */
@@ -78,7 +78,7 @@
 
 #endif /* defined(__APPLE__) */
 
-#define mem_aligned_alloc(s) aligned_alloc(s, 32)
+#define mem_aligned_alloc(s) aligned_alloc(32, s)
 #define mem_aligned_free free
 
 #define ALIGNAS(s) __attribute__((aligned(s)))
@@ -0,0 +1,176 @@
+#ifndef PORTABLE_THREAD_H
+#define PORTABLE_THREAD_H
+
+/* the few threading primitives the library needs - Win32 threads,
+   SRW locks and condition variables (Vista or later) on Windows,
+   POSIX threads elsewhere */
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#include <process.h>
+
+typedef SRWLOCK            THREAD_MUTEX;
+typedef CONDITION_VARIABLE THREAD_COND;
+typedef HANDLE             THREAD;
+
+#define THREAD_RESULT unsigned
+#define THREAD_CALL   __stdcall
+#define THREAD_RETURN 0
+
+typedef THREAD_RESULT (THREAD_CALL *THREAD_FUNC)(void *arg);
+
+static __inline int thread_mutex_init(THREAD_MUTEX *m)
+{
+	InitializeSRWLock(m);
+	return 1;
+}
+
+static __inline void thread_mutex_destroy(THREAD_MUTEX *m)
+{
+	(void)m;
+}
+
+static __inline void thread_mutex_lock(THREAD_MUTEX *m)
+{
+	AcquireSRWLockExclusive(m);
+}
+
+static __inline void thread_mutex_unlock(THREAD_MUTEX *m)
+{
+	ReleaseSRWLockExclusive(m);
+}
+
+static __inline int thread_cond_init(THREAD_COND *c)
+{
+	InitializeConditionVariable(c);
+	return 1;
+}
+
+static __inline void thread_cond_destroy(THREAD_COND *c)
+{
+	(void)c;
+}
+
+static __inline void thread_cond_wait(THREAD_COND *c, THREAD_MUTEX *m)
+{
+	SleepConditionVariableSRW(c, m, INFINITE, 0);
+}
+
+/* 0 when msec has passed, callers check their condition either way */
+static __inline int thread_cond_timedwait(THREAD_COND *c, THREAD_MUTEX *m, int msec)
+{
+	return SleepConditionVariableSRW(c, m, (DWORD)msec, 0) ? 1 : 0;
+}
+
+static __inline void thread_cond_signal(THREAD_COND *c)
+{
+	WakeConditionVariable(c);
+}
+
+static __inline void thread_cond_broadcast(THREAD_COND *c)
+{
+	WakeAllConditionVariable(c);
+}
+
+static __inline int thread_create(THREAD *t, THREAD_FUNC func, void *arg)
+{
+	*t = (HANDLE)_beginthreadex(NULL, 0, func, arg, 0, NULL);
+	return (*t != NULL) ? 1 : 0;
+}
+
+static __inline void thread_join(THREAD *t)
+{
+	WaitForSingleObject(*t, INFINITE);
+	CloseHandle(*t);
+}
+
+#else /* defined(_WIN32) */
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+typedef pthread_mutex_t    THREAD_MUTEX;
+typedef pthread_cond_t     THREAD_COND;
+typedef pthread_t          THREAD;
+
+#define THREAD_RESULT void *
+#define THREAD_CALL
+#define THREAD_RETURN NULL
+
+typedef THREAD_RESULT (THREAD_CALL *THREAD_FUNC)(void *arg);
+
+static inline int thread_mutex_init(THREAD_MUTEX *m)
+{
+	return (pthread_mutex_init(m, NULL) == 0) ? 1 : 0;
+}
+
+static inline void thread_mutex_destroy(THREAD_MUTEX *m)
+{
+	pthread_mutex_destroy(m);
+}
+
+static inline void thread_mutex_lock(THREAD_MUTEX *m)
+{
+	pthread_mutex_lock(m);
+}
+
+static inline void thread_mutex_unlock(THREAD_MUTEX *m)
+{
+	pthread_mutex_unlock(m);
+}
+
+static inline int thread_cond_init(THREAD_COND *c)
+{
+	return (pthread_cond_init(c, NULL) == 0) ? 1 : 0;
+}
+
+static inline void thread_cond_destroy(THREAD_COND *c)
+{
+	pthread_cond_destroy(c);
+}
+
+static inline void thread_cond_wait(THREAD_COND *c, THREAD_MUTEX *m)
+{
+	pthread_cond_wait(c, m);
+}
+
+static inline int thread_cond_timedwait(THREAD_COND *c, THREAD_MUTEX *m, int msec)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += msec / 1000;
+	ts.tv_nsec += (long)(msec % 1000) * 1000000;
+	if(ts.tv_nsec >= 1000000000){
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	return (pthread_cond_timedwait(c, m, &ts) == ETIMEDOUT) ? 0 : 1;
+}
+
+static inline void thread_cond_signal(THREAD_COND *c)
+{
+	pthread_cond_signal(c);
+}
+
+static inline void thread_cond_broadcast(THREAD_COND *c)
+{
+	pthread_cond_broadcast(c);
+}
+
+static inline int thread_create(THREAD *t, THREAD_FUNC func, void *arg)
+{
+	return (pthread_create(t, NULL, func, arg) == 0) ? 1 : 0;
+}
+
+static inline void thread_join(THREAD *t)
+{
+	pthread_join(*t, NULL);
+}
+
+#endif /* defined(_WIN32) */
+
+#endif /* PORTABLE_THREAD_H */
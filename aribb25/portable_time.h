@@ -0,0 +1,33 @@
+#ifndef PORTABLE_TIME_H
+#define PORTABLE_TIME_H
+
+/* a millisecond clock for timeouts and ages - GetTickCount64() on
+   Windows (Vista or later), CLOCK_MONOTONIC elsewhere */
+
+#include <stdint.h>
+
+#if defined(_WIN32)
+
+#include <windows.h>
+
+static __inline int64_t get_msec(void)
+{
+	return (int64_t)GetTickCount64();
+}
+
+#else /* defined(_WIN32) */
+
+#include <time.h>
+
+static inline int64_t get_msec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif /* defined(_WIN32) */
+
+#endif /* PORTABLE_TIME_H */
@@ -25,6 +25,7 @@
 	#define _topen _open
 	#include <unistd.h>
 	#include <sys/time.h>
+	#include <sys/uio.h>
 #endif
 
 #include "arib_std_b25.h"
@@ -39,6 +40,7 @@ typedef struct {
 	int32_t power_ctrl;
 	int32_t simd_instruction;
 	int32_t benchmark;
+	int32_t worker;
 } OPTION;
 
 static void show_usage();
@@ -48,6 +50,7 @@ static void test_arib_std_b25(OPTION *opt);
 #else
 static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt);
 #endif
+static int write_output(int fd, ARIB_STD_B25 *b25);
 static void show_bcas_power_on_control_info(B_CAS_CARD *bcas);
 static void run_multi2_benchmark_test(OPTION *opt);
 
@@ -120,6 +123,9 @@ static void show_usage()
 	_ftprintf(stderr, _T("  -v verbose\n"));
 	_ftprintf(stderr, _T("     0: silent\n"));
 	_ftprintf(stderr, _T("     1: show processing status (default)\n"));
+	_ftprintf(stderr, _T("  -t threads\n"));
+	_ftprintf(stderr, _T("     0: decrypt on the main thread only (default)\n"));
+	_ftprintf(stderr, _T("     n: decrypt on n more threads\n"));
 #ifdef ENABLE_MULTI2_SIMD
 	_ftprintf(stderr, _T("  -i instruction\n"));
 	_ftprintf(stderr, _T("     0: use no SIMD instruction\n"));
@@ -142,6 +148,7 @@ static int parse_arg(OPTION *dst, int argc, TCHAR **argv)
 	dst->verbose = 1;
 	dst->simd_instruction = 3;
 	dst->benchmark = 0;
+	dst->worker = 0;
 
 	for(i=1;i<argc;i++){
 		if(argv[i][0] != '-'){
@@ -188,6 +195,14 @@ static int parse_arg(OPTION *dst, int argc, TCHAR **argv)
 				i += 1;
 			}
 			break;
+		case 't':
+			if(argv[i][2]){
+				dst->worker = _ttoi(argv[i]+2);
+			}else{
+				dst->worker = _ttoi(argv[i+1]);
+				i += 1;
+			}
+			break;
 #ifdef ENABLE_MULTI2_SIMD
 		case 'i':
 			if(argv[i][2]){
@@ -302,6 +317,18 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 		goto LAST;
 	}
 
+	code = b25->set_in_place(b25, 1);
+	if(code < 0){
+		_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::set_in_place() : code=%d\n"), code);
+		goto LAST;
+	}
+
+	code = b25->set_worker_count(b25, opt->worker);
+	if(code < 0){
+		_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::set_worker_count() : code=%d\n"), code);
+		goto LAST;
+	}
+
 #ifdef ENABLE_MULTI2_SIMD
 	code = b25->set_simd_mode(b25, opt->simd_instruction);
 	if(code < 0){
@@ -345,12 +372,17 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 	while( (n = _read(sfd, data, sizeof(data))) > 0 ){
 		sbuf.data = data;
 		sbuf.size = n;
+		offset += n;
 
 		code = b25->put(b25, &sbuf);
 		if(code < 0){
 			_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::put() : code=%d\n"), code);
-			dbuf.data = data;
-			dbuf.size = n;
+			/* what was done before the failure, then sbuf (narrowed
+			   to the unprocessed input) as it is */
+			if(write_output(dfd, b25) < 0){
+				goto LAST;
+			}
+			dbuf = sbuf;
 			if(code < ARIB_STD_B25_ERROR_NO_ECM_IN_HEAD_32M){
 				uint8_t *p = NULL;
 				b25->withdraw(b25, &sbuf);
@@ -359,22 +391,21 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 						free(_data);
 						_data = NULL;
 					}
-					p = (uint8_t *)malloc(sbuf.size + n);
+					p = (uint8_t *)malloc(sbuf.size + dbuf.size);
 				}
 				if(p != NULL){
 					memcpy(p, sbuf.data, sbuf.size);
-					memcpy(p + sbuf.size, data, n);
+					memcpy(p + sbuf.size, dbuf.data, dbuf.size);
 					dbuf.data = p;
-					dbuf.size = sbuf.size + n;
+					dbuf.size += sbuf.size;
 					_data = p;
 				}
 			}
 		}else{
-			code = b25->get(b25, &dbuf);
-			if(code < 0){
-				_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::get() : code=%d\n"), code);
+			if(write_output(dfd, b25) < 0){
 				goto LAST;
 			}
+			dbuf.size = 0;
 		}
 
 		if(dbuf.size > 0){
@@ -385,7 +416,6 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 			}
 		}
 
-		offset += sbuf.size;
 		if(opt->verbose != 0){
 #ifndef ENABLE_ARIB_STREAM_TEST
 			m = (int)(10000ULL*offset/total);
@@ -422,20 +452,10 @@ static void test_arib_std_b25(const TCHAR *src, const TCHAR *dst, OPTION *opt)
 		goto LAST;
 	}
 
-	code = b25->get(b25, &dbuf);
-	if(code < 0){
-		_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::get() : code=%d\n"), code);
+	if(write_output(dfd, b25) < 0){
 		goto LAST;
 	}
 
-	if(dbuf.size > 0){
-		n = _write(dfd, dbuf.data, dbuf.size);
-		if(n != dbuf.size){
-			_ftprintf(stderr, _T("error - failed on _write(%d)\n"), dbuf.size);
-			goto LAST;
-		}
-	}
-
 	if(opt->verbose != 0){
 		mbps = 0.0;
 #if defined(_WIN32)
@@ -515,6 +535,53 @@ LAST:
 	}
 }
 
+/* writes out what get_iov() returns, in one writev() per 64 segments */
+static int write_output(int fd, ARIB_STD_B25 *b25)
+{
+	int code,i,n;
+	ARIB_STD_B25_BUFFER *iov;
+#if !defined(_WIN32)
+	struct iovec vec[64];
+	int m;
+	ssize_t size;
+#endif
+
+	code = b25->get_iov(b25, &iov);
+	if(code < 0){
+		_ftprintf(stderr, _T("error - failed on ARIB_STD_B25::get_iov() : code=%d\n"), code);
+		return -1;
+	}
+
+#if defined(_WIN32)
+	for(i=0;i<code;i++){
+		n = _write(fd, iov[i].data, iov[i].size);
+		if(n != iov[i].size){
+			_ftprintf(stderr, _T("error - failed on _write(%d)\n"), iov[i].size);
+			return -1;
+		}
+	}
+#else
+	for(i=0;i<code;i+=m){
+		m = code - i;
+		if(m > 64){
+			m = 64;
+		}
+		size = 0;
+		for(n=0;n<m;n++){
+			vec[n].iov_base = iov[i+n].data;
+			vec[n].iov_len = iov[i+n].size;
+			size += iov[i+n].size;
+		}
+		if(writev(fd, vec, m) != size){
+			_ftprintf(stderr, _T("error - failed on writev(%d)\n"), (int)size);
+			return -1;
+		}
+	}
+#endif
+
+	return 0;
+}
+
 static void show_bcas_power_on_control_info(B_CAS_CARD *bcas)
 {
 	int code;